@@ -0,0 +1,76 @@
+from tqdm import tqdm
+import os
+import re
+import subprocess
+import time
+import argparse
+
+ENCODINGS = ["bv", "bits", "frozen", "inline"]
+
+def parse_args():
+    parser = argparse.ArgumentParser(epilog="Example: python3 compare_encodings.py --testcases_dir ../testcases/2_colourability/sat/ --exec ./build/2dqr --args=\"--avr_bin ../avr/build\" --cwd=./build")
+    parser.add_argument('--testcases_dir', type=str, required=True, help="Directory containing testcases")
+    parser.add_argument('--exec', type=str, required=True, help="Executable to run")
+    parser.add_argument('--cwd', type=str, help="Working directory when running the executable")
+    parser.add_argument('--args', type=str, default="", help="Additional arguments to pass to executable")
+    parser.add_argument('--prepass', type=str, default="--filter_timeout 0 --expansion_budget 0 --bmc_timeout 0",
+                        help="Arguments for the engines run before AVR, all disabled so that AVR is compared")
+    parser.add_argument('--encodings', type=str, default=",".join(ENCODINGS), help="Comma separated encodings to compare")
+    parser.add_argument('--timeout', type=int, default=600, help="Wall-clock limit per run in seconds")
+    parser.add_argument('--log', type=str, default="./encodings.csv", help="Output csv file")
+    return parser.parse_args()
+
+def run(exec_path, args, f, encoding, timeout, cwd):
+    t0 = time.time()
+    try:
+        p = subprocess.run([exec_path, "--input", f, "--encoding", encoding, "--avr_timeout", str(timeout)] + args.split(),
+                           cwd=cwd, capture_output=True, text=True, timeout=timeout + 10)
+        out = p.stdout
+    except subprocess.TimeoutExpired:
+        return "TIMEOUT", float(timeout), time.time() - t0
+    # ANSI colour codes are stripped before matching the solver messages
+    out = re.sub(r"\x1b\[[0-9;]*m", "", out)
+    avr_time = sum(float(t) for t in re.findall(r"AVR time: ([0-9.]+) s", out))
+    result = "ERROR"
+    for line in out.splitlines():
+        if line in ("[INFO] SAT", "[INFO] UNSAT", "[INFO] Timeout"):
+            result = line[len("[INFO] "):].upper()
+    return result, avr_time, time.time() - t0
+
+def main():
+    args = parse_args()
+    testcases_dir = os.path.abspath(args.testcases_dir)
+    exec_path = os.path.abspath(args.exec)
+    encodings = args.encodings.split(",")
+
+    log_file = open(args.log, "w+")
+    log_file.write("testcase,encoding,result,avr_time,time\n")
+    log_file.flush()
+
+    solved = {e: 0 for e in encodings}
+    avr_total = {e: 0.0 for e in encodings}
+    best = {e: 0 for e in encodings}
+    for filename in tqdm(sorted(os.listdir(testcases_dir))):
+        f = os.path.join(testcases_dir, filename)
+        if not os.path.isfile(f):
+            continue
+        times = {}
+        for e in encodings:
+            result, avr_time, total = run(exec_path, args.prepass + " " + args.args, f, e, args.timeout, args.cwd)
+            log_file.write("{},{},{},{:.3f},{:.3f}\n".format(filename, e, result, avr_time, total))
+            log_file.flush()
+            if result in ("SAT", "UNSAT"):
+                solved[e] += 1
+                avr_total[e] += avr_time
+                times[e] = avr_time
+        if times:
+            best[min(times, key=times.get)] += 1
+
+    log_file.close()
+
+    print("{:<8} {:>7} {:>14} {:>7}".format("encoding", "solved", "AVR time (s)", "fastest"))
+    for e in encodings:
+        print("{:<8} {:>7} {:>14.3f} {:>7}".format(e, solved[e], avr_total[e], best[e]))
+
+if __name__ == '__main__':
+    main()
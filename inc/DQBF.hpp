@@ -3,11 +3,17 @@
 
 #include <z3++.h>
 
+#include <boost/dynamic_bitset.hpp>
 #include <boost/functional/hash.hpp>
+#include <istream>
+#include <optional>
 #include <stack>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "circuit.hpp"
+
 // Data structure for DQBF
 class DQBF {
    public:
@@ -17,22 +23,61 @@ class DQBF {
     z3::context ctx;
     DQBF();
 
-    // Initialize from dqdimacs/dqcir file
+    // Initialize from dqdimacs/dqcir file (see open_input) or stream
     void from_dqdimacs(std::string path);
     void from_dqcir(std::string path);
+    void from_dqdimacs(std::istream& file);
+    void from_dqcir(std::istream& file);
+
+    // Initialize from the text of a dqcir/dqdimacs file
+    void from_buffer(const std::string& text);
+
+    // Build in memory: add the variables, build phi in circuit (inputs via lit()) and set phi_lit
+    uint32_t add_universal(const std::string& name);
+    uint32_t add_existential(const std::string& name, const std::vector<uint32_t>& deps);
+    Circuit::lit lit(uint32_t id) const { return Circuit::mk_lit(circuit.input_nodes[id]); }
+
+    // Apply the next batch of matrix edits from a delta stream (see README), up to a "solve" line or EOF
+    // Returns false if the stream has no further batch
+    bool read_delta(std::istream& file);
 
     // Print problem info
     void print_stat(bool detailed = false, bool int_ver = true);
 
-    // Universal variables, (name)
-    std::vector<z3::expr> u_vars;
-    std::vector<std::string> u_vars_str;
+    // Variables, indexed by a dense id (input id of the circuit)
+    std::vector<std::string> var_names;
+    std::unordered_map<std::string, uint32_t> var_ids;
+
+    // Universal variables, (id)
+    std::vector<uint32_t> u_vars;
 
-    // Existential variables, (name, dependency set)
-    std::vector<std::pair<z3::expr, std::vector<z3::expr>>> e_vars;
-    std::vector<std::pair<std::string, std::vector<std::string>>> e_vars_str;
+    // Existential variables, (id) and dependency set (bit i set iff depending on u_vars[i])
+    std::vector<uint32_t> e_vars;
+    std::vector<boost::dynamic_bitset<>> e_deps;
 
     // Matrix
-    z3::expr phi = z3::expr(ctx);
+    Circuit circuit;
+    Circuit::lit phi_lit = Circuit::TRUE;
+    // Top-level conjuncts of phi (clauses for dqdimacs) and named gates (dqcir), for deltas
+    std::vector<Circuit::lit> conjuncts;
+    std::unordered_map<std::string, Circuit::lit> gates;
+
+    // Replace the matrix by root
+    void set_phi(Circuit::lit root);
+
+    // Dependency set of the k-th existential variable, (id) in the order of u_vars
+    std::vector<uint32_t> deps(size_t k) const;
+
+    // Z3 views, built on demand
+    z3::expr var(uint32_t id);
+    const z3::expr& phi();
+
+   private:
+    uint32_t add_var(const std::string& name);
+    Circuit::lit gate_lit(std::string name, uint line_cnt);
+    void define_gate(const std::vector<std::string>& parts, uint line_cnt);
+
+    std::optional<z3::expr> phi_expr;
+    uint delta_line = 0;
 };
-#endif
\ No newline at end of file
+#endif
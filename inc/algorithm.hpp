@@ -8,37 +8,133 @@
 #include "DQBF.hpp"
 #include "utils.hpp"
 #include "avr_wrapper.hpp"
+#include "solver.hpp"
+
+// A patch fixes y_0 to a value on a cube over z_0 (variable name, value)
+struct Patch_cube {
+    bool y_0;
+    std::vector<std::pair<std::string, bool>> z_0;
+};
 
 class Algorithm {
    public:
     Algorithm(DQBF& p, AVR_Wrapper& avr);
 
-    void run(bool gen_skolem = false);
+    Solve_result run(const Solve_options& options = Solve_options());
+
+    // Seed the reachability analysis with the lemmas (saved by a run on a related instance)
+    // that are inductive for this instance
+    void load_lemmas(std::string path);
+
+    // Continue a run from a checkpoint (see save_checkpoint): replay its patches, the saved invariant clauses
+    // seed the next AVR run
+    void resume(std::string path);
+
+    // The matrix of p was edited (same prefix): drop the patches and re-filter the lemmas.
+    // The invariant and Skolem functions of the last SAT run are re-validated by the next run().
+    void matrix_changed();
 
    private:
     AVR_Wrapper& avr;
     DQBF& p;
     z3::context& ctx;
 
+    Encoding encoding = Encoding::BV;
+
+    // State variables of the emitted system, each holds bits [low, high] of the register
+    struct State_var {
+        std::string name;
+        int high;
+        int low;
+        bool boolean;  // Bool instead of a bitvector of width high - low + 1
+        bool frozen;   // never changes, no initial constraint
+    };
+    std::vector<State_var> state_vars();
+    // The register as a concatenation of the (next) state variables
+    z3::expr state_register(bool next);
+
+    // Names of the universal variables x and of the dependency sets z_0, z_1
+    std::vector<std::string> x_str;
+    std::vector<std::string> z_str[2];
+
     size_t max_dep_size;
     size_t register_size;
     std::unordered_map<std::string, int> idx_lookup;
+    // Name of each register bit
+    std::vector<std::string> slot_names;
 
     z3::expr r;
     z3::expr r_next;
 
     z3::expr initial;
+    z3::expr base_transition;  // without patches
     z3::expr transition;
     z3::expr property;
 
+    // phi as an uninterpreted function in the transition relation
+    z3::func_decl phi_decl;
+
+    // Imported lemmas over r, and the conjunction of those which are inductive for the current transition
+    std::vector<z3::expr> seed_lemmas;
+    z3::expr lemmas;
+    // Encoding whose initial states the lemmas were filtered against
+    Encoding lemmas_encoding = Encoding::BV;
+
+    // Invariant (over REG) and Skolem functions of the last SAT run, kept across matrix edits
+    std::optional<z3::expr> last_S;
+    std::vector<z3::expr> last_skolem;
+
+    // Patches of the current transition relation, and refinement iterations including resumed ones
+    std::vector<Patch_cube> patches;
+    size_t iteration = 0;
+    // The patches come from a checkpoint, the next AVR run must return SAT
+    bool resumed = false;
+
+    // Text of the phi definition in the encoding, for the matrix it was printed from
+    std::string phi_text;
+    Circuit::lit phi_text_lit = Circuit::FALSE;
+
+    // Transitions added by the patches, emitted as one define-fun each
+    std::vector<z3::expr> patch_transitions;
+    // What the last print_to_file wrote: the file ends with the .trans definition at emitted_offset,
+    // preceded by the definitions of the first emitted_patches patches
+    std::string emitted_path;
+    std::streamoff emitted_offset = 0;
+    size_t emitted_patches = 0;
+    Encoding emitted_encoding = Encoding::BV;
+    Circuit::lit emitted_phi_lit = Circuit::FALSE;
+    std::optional<z3::expr> emitted_frame;
+
     z3::expr extract_S(std::string inv_smt2);
     z3::expr skolem_from_S(z3::expr S, int k);
-    void patch(z3::model counterexample);
+    Patch_cube cube_from_model(z3::model counterexample);
+    Patch_cube generalise(const Patch_cube& cube, const z3::expr& f_0, const z3::expr& f_1);
+    void patch(const Patch_cube& cube);
+    void save_checkpoint(const z3::expr& S, std::string path);
+    std::string fingerprint();
+
+    bool S_still_inductive(z3::expr S);
+    AVR_result qbf_filters(unsigned timeout, bool skolem, std::vector<z3::expr>& f);
+    void expansion_sets(z3::expr_vector& D, z3::expr_vector& A, z3::expr_vector& B, z3::expr_vector& R);
+    size_t expansion_size();
+    AVR_result expand(unsigned timeout, bool skolem, std::vector<z3::expr>& f);
+    AVR_result bmc(unsigned timeout, std::string cex_path);
+
+    z3::expr inline_phi(z3::expr e);
+    z3::expr named_register();
+    z3::expr encoded_initial();
+    std::vector<z3::expr> inductive_subset(const std::vector<z3::expr>& candidates);
+    size_t filter_lemmas();
+    void save_lemmas(z3::expr S, std::string path);
+    std::string target_name(int k, const std::string& v);
 
+    z3::expr encode(z3::expr e);
+    std::string patch_definition(size_t i);
     void print_to_file(std::string path);
+    z3::expr fraig(z3::expr f, z3::expr g, z3::expr& g_out);
+    void minimise_skolem(z3::expr& f_0, z3::expr& f_1, z3::solver& solver, unsigned time_limit_ms);
     void dependencies_check(z3::expr& f_0, z3::expr& f_1);
     void skolem_check(z3::expr& f_0, z3::expr& f_1);
-    void save_proof(z3::expr& f_0, z3::expr& f_1, std::string path);
 };
 
 #endif
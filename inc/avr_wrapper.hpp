@@ -1,7 +1,20 @@
 #ifndef AVR_WRAPPER_HPP
 #define AVR_WRAPPER_HPP
 
+#include <sys/types.h>
+
+#include <atomic>
+#include <boost/process.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
 
 enum AVR_result {
     SAT,
@@ -10,12 +23,100 @@ enum AVR_result {
     UNKNOWN
 };
 
+// Progress of a running AVR, parsed from its output (-1 if not reported yet)
+struct AVR_progress {
+    int frame = -1;
+    int lemmas = -1;
+    int bound = -1;
+    double elapsed = 0;  // seconds since start
+    std::string line;    // last output line
+};
+
+// AVR was stopped by a forwarded signal, the caller decides how to exit
+class AVR_interrupted : public std::runtime_error {
+   public:
+    int signal;
+    AVR_interrupted(int signal) : std::runtime_error("Interrupted"), signal(signal) {}
+};
+
 class AVR_Wrapper {
     private:
         std::string bin_path;
+
+        std::unique_ptr<boost::process::group> group;
+        std::unique_ptr<boost::process::child> proc;
+        std::unique_ptr<boost::process::ipstream> out;
+        std::unique_ptr<boost::process::ipstream> err;
+        std::vector<std::thread> readers;
+        std::thread watchdog;
+
+        std::mutex mtx;
+        // Serialises on_progress calls from the reader threads and the watchdog
+        std::mutex callback_mtx;
+        AVR_progress progress;
+        int64_t start_time;
+        int64_t last_output;
+        std::atomic<bool> cancelled;
+        std::string stop_reason;
+
+        void read_output(boost::process::ipstream& in, Log_level level);
+        void parse_progress(const std::string& line);
+        void watch();
+
+        // Processes of the AVR process group seen by the watchdog, for the trace
+        struct Child_process {
+            std::string name;
+            int64_t first;
+            int64_t last;
+        };
+        std::map<pid_t, Child_process> children;
+        void sample_children(int64_t now);
+        void trace_children(int pid, int64_t end);
+
+        // Process group of the running AVR
+        pid_t pgid = 0;
+
+        // Process groups of all running AVRs (0 = free slot), signals are forwarded to each of them
+        static constexpr size_t max_children = 256;
+        static std::atomic<int> pending_signal;
+        static std::atomic<pid_t> child_groups[max_children];
+        static void register_group(pid_t pgid);
+        static void unregister_group(pid_t pgid);
+        static void on_signal(int sig);
     public:
         AVR_Wrapper(std::string bin_path);
         AVR_result run_avr(std::string input);
+
+        // Asynchronous interface: start AVR (no shell), then wait for the result
+        void start(std::string input);
+        AVR_result wait();
+        // Kill the running AVR, wait() then reports a timeout
+        void cancel();
+        AVR_progress get_progress();
+
+        // Called on every progress change and as a heartbeat once per second, never concurrently
+        std::function<void(const AVR_progress&)> on_progress;
+        // Receives every output line of AVR (from the reader threads), dropped if empty
+        Log_sink log = log_to_stdout;
+        // Wall-clock limit in seconds
+        int timeout = 600;
+        // Kill AVR if it prints no output line for this many seconds (0 = never)
+        int stall_timeout = 0;
+
+        // Overrides of the default arguments of AVR: "timeout" (AVR's own limit in seconds), "memout" (MB),
+        // "abstraction" (e.g. sa+uf) or "arg<i>" for the i-th argument, see start()
+        std::map<std::string, std::string> options;
+
+        // AVR runs in this directory and writes its results to <work_dir>/output/work_test
+        std::string work_dir = ".";
+        std::string result_dir();
+
+        // Statistics over all runs
+        size_t runs = 0;
+        double total_time = 0;
+
+        // Forward SIGINT/SIGTERM/SIGHUP to the running AVR process group
+        static void forward_signals();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,86 @@
+#ifndef CIRCUIT_HPP
+#define CIRCUIT_HPP
+
+#include <z3++.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Structurally hashed circuit with n-ary AND and binary XOR gates (struct of arrays)
+// Nodes are created in topological order, node 0 is the constant false.
+// Edges are literals: node index * 2 + complement bit, so OR/NAND/NOR/NOT are complemented edges.
+class Circuit {
+   public:
+    typedef uint32_t lit;
+
+    enum Kind : uint8_t {
+        CONST,
+        INPUT,
+        AND,
+        XOR
+    };
+
+    static constexpr lit FALSE = 0;
+    static constexpr lit TRUE = 1;
+
+    static lit mk_lit(uint32_t node, bool neg = false) { return (node << 1) | (neg ? 1 : 0); }
+    static uint32_t node(lit l) { return l >> 1; }
+    static bool is_neg(lit l) { return l & 1; }
+
+    Circuit();
+
+    // Input i is the i-th created input
+    lit add_input();
+
+    lit mk_and(std::vector<lit> fanin);
+    lit mk_or(std::vector<lit> fanin);
+    lit mk_xor(lit a, lit b);
+
+    size_t num_nodes() const { return kind.size(); }
+    size_t num_inputs() const { return input_nodes.size(); }
+    size_t num_fanins(uint32_t n) const { return fanin_begin[n + 1] - fanin_begin[n]; }
+    lit fanin(uint32_t n, size_t i) const { return fanins[fanin_begin[n] + i]; }
+
+    // Number of gates in the cone of root
+    size_t cone_size(lit root) const;
+    // Inputs in the cone of root (as input indices, ascending)
+    std::vector<uint32_t> support(lit root) const;
+    // Bit-parallel simulation, one 64-bit pattern word per input, returns one word per node
+    std::vector<uint64_t> simulate(const std::vector<uint64_t>& input_words) const;
+    static uint64_t value(const std::vector<uint64_t>& node_words, lit l) { return is_neg(l) ? ~node_words[node(l)] : node_words[node(l)]; }
+
+    // Materialise the cone of root as a z3 expression, inputs[i] is used for input i
+    z3::expr to_expr(z3::context& ctx, lit root, const std::vector<z3::expr>& inputs) const;
+    // Add a Boolean z3 expression (and/or/not/xor/=/distinct/=>/ite over constants), inputs maps the id of each
+    // constant to its literal. Bitvector terms without bitvector constants (numerals, concat, extract, ite,
+    // bitwise operators, = and unsigned comparisons) are bit-blasted. Throws std::invalid_argument otherwise.
+    lit add_expr(const z3::expr& e, const std::unordered_map<unsigned, lit>& inputs);
+
+    // Copy the cone of root from src, map holds the literal of each copied node of src and must map its inputs
+    lit add_cone(const Circuit& src, lit root, std::unordered_map<uint32_t, lit>& map);
+
+    // Copy of the cones of roots (updated in place) in which equivalent nodes are merged: candidates
+    // with equal simulation signatures (up to complement) are proven equal with z3 (SAT sweeping)
+    Circuit fraig(std::vector<lit>& roots, z3::context& ctx, unsigned timeout_ms = 1000) const;
+
+    // Struct of arrays, indexed by node
+    std::vector<Kind> kind;
+    std::vector<uint32_t> fanin_begin;  // fanins of node n are fanins[fanin_begin[n] .. fanin_begin[n + 1])
+    std::vector<lit> fanins;
+    std::vector<uint32_t> input_index;  // input index of INPUT nodes
+    std::vector<uint32_t> input_nodes;  // node of each input
+
+   private:
+    // Bit-blast the bitvector term (or predicate over bitvectors) t, its arguments are in memo and words
+    void add_bv_term(const z3::expr& t, std::unordered_map<unsigned, lit>& memo,
+                     std::unordered_map<unsigned, std::vector<lit>>& words);
+
+    // Structural hashing, hash of (kind, fanins) -> node
+    std::unordered_multimap<size_t, uint32_t> strash;
+
+    lit add_gate(Kind k, const std::vector<lit>& fanin);
+    std::vector<bool> cone(lit root) const;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "DQBF.hpp"
+
+// Cheap features of a 2-DQBF, computed after parsing
+struct Instance_features {
+    size_t universals = 0;
+    size_t dep_0 = 0;       // |z0|
+    size_t dep_1 = 0;       // |z1|
+    size_t shared = 0;      // |z0 ∩ z1|
+    size_t overlap = 0;     // |z0 ∩ z1| in percent of |z0 ∪ z1|
+    size_t dag_size = 0;    // gates in the cone of phi
+    size_t conjuncts = 0;   // top-level conjuncts of phi
+    bool cnf = false;       // every conjunct is a clause (e.g. Tseitin-encoded dqdimacs)
+
+    // Value of a feature by name ("universals", "dep0", "dep1", "shared", "overlap", "dag", "conjuncts", "cnf"),
+    // throws DQBF_error for unknown names
+    size_t get(const std::string& name) const;
+    std::string to_string() const;
+};
+
+Instance_features instance_features(DQBF& p);
+
+// Overrides of the AVR arguments by key: "timeout", "memout", "abstraction" or "arg<i>" (see AVR_Wrapper::start).
+// A timeout above Solve_options::avr_timeout also raises the wall-clock limit of the AVR_Wrapper.
+typedef std::map<std::string, std::string> AVR_config;
+
+// Ordered rules mapping instance features to AVR options, the first rule whose conditions all hold is used.
+// One rule per line: conditions "<feature><op><number>" (op is <, <=, >, >=, = or !=) or "default",
+// then "->" and the overrides "<key>=<value>". # starts a comment, e.g.
+//   universals>=200 cnf=1 -> abstraction=sa timeout=7200
+// There are no built-in rules, without a table AVR runs with its defaults.
+class Config_table {
+   public:
+    // Replace the rules by those in path, throws DQBF_error on syntax errors
+    void load(const std::string& path);
+
+    // Overrides of the first matching rule (none if no rule matches), rule is set to its text
+    AVR_config select(const Instance_features& f, std::string& rule) const;
+
+   private:
+    struct Condition {
+        std::string feature;
+        std::string op;
+        size_t value;
+    };
+    struct Rule {
+        std::vector<Condition> conditions;
+        AVR_config options;
+        std::string text;
+    };
+    std::vector<Rule> rules;
+
+    Rule parse_rule(const std::string& line, uint line_cnt);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef DECOMPOSE_HPP
+#define DECOMPOSE_HPP
+
+#include <vector>
+
+#include "DQBF.hpp"
+#include "solver.hpp"
+
+// Conjuncts of phi over a connected set of variables (sharing a variable connects two conjuncts)
+struct Component {
+    std::vector<uint32_t> vars;  // ids in the DQBF, ascending
+    std::vector<Circuit::lit> conjuncts;
+    std::vector<size_t> e_idx;   // existentials of the component, as indices into e_vars
+};
+
+// Connected components of the top-level conjuncts of phi, universals that do not occur in phi are dropped
+std::vector<Component> components(DQBF& p);
+
+// The 2-DQBF of a component: its universals, its existentials with the dependencies restricted to them
+// (plus a dummy existential without dependencies if it has only one) and the conjunction of its conjuncts
+void build_component(DQBF& p, const Component& c, DQBF& sub);
+
+// Solve p component-wise: components without existentials are checked for validity, the others are
+// solved in parallel (each in its own work directory). The verdicts and Skolem functions are combined.
+// Solves p as a whole if it has a single component. The statistics flags are set if some component was
+// answered that way. Checkpoints are per instance, so options.resume is rejected with DQBF_error.
+Solve_result solve_components(DQBF& p, const Solve_options& options);
+
+#endif
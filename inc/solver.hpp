@@ -0,0 +1,117 @@
+#ifndef SOLVER_HPP
+#define SOLVER_HPP
+
+#include <z3++.h>
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DQBF.hpp"
+#include "avr_wrapper.hpp"
+#include "utils.hpp"
+
+// Encoding of the transition system given to AVR (the register layout is the same in all of them)
+enum class Encoding {
+    BV,         // one bitvector state variable .R
+    BITS,       // one Boolean state variable per register bit
+    FROZEN,     // target fields in a separate state variable .T without initial constraint, never changed
+    INLINE_PHI  // as BV, with phi substituted into the transition instead of an uninterpreted function
+};
+
+// Parse "bv", "bits", "frozen" or "inline", throws DQBF_error otherwise
+Encoding encoding_from_string(const std::string& name);
+
+// Options of a single solve() call
+struct Solve_options {
+    // Generate (and check) Skolem functions for SAT instances
+    bool skolem = false;
+    // Shrink the Skolem functions with phi as the care set before they are returned/saved
+    bool minimise = false;
+    // Path to the AVR build directory
+    std::string avr_bin = "../avr/build";
+    // Directory for the encoding and the AVR output, a fresh temporary directory (removed afterwards) if empty
+    std::string work_dir = "";
+    // Directory for proof.smt2 and the checkpoint of the Skolem refinement (checkpoint.smt2),
+    // nothing is written if empty
+    std::string output_dir = "";
+    // Continue from the checkpoint in output_dir
+    bool resume = false;
+    Encoding encoding = Encoding::BV;
+    // Time limit in ms of each check of the QBF filters run before the encoding (0 = no filters, the default)
+    int filter_timeout = 0;
+    // Decide by universal expansion (see Algorithm::expand) if 2^(|z0 \ z1| + |z1 \ z0| + |x \ (z0 ∪ z1)|) times
+    // the size of phi is at most the budget (0 = never, the default), within the time limit in ms
+    size_t expansion_budget = 0;
+    int expansion_timeout = 10000;
+    // Time limit in ms of the bounded model checking run before AVR, for shallow UNSAT instances
+    // (0 = no BMC, the default)
+    int bmc_timeout = 0;
+    // Split phi into components over disjoint variables and solve them in parallel (see solve_components)
+    bool decompose = false;
+    // AVR limits, see AVR_Wrapper
+    int avr_timeout = 600;
+    int avr_stall = 0;
+    // Rule table selecting AVR options from the instance features (see Config_table), AVR defaults if empty
+    std::string config = "";
+    std::function<void(const AVR_progress&)> on_progress;
+    // Solver messages and AVR output, dropped if empty (the CLI passes log_to_stdout)
+    Log_sink log;
+    // Lemma files, see Algorithm::load_lemmas (empty = unused)
+    std::string load_lemmas = "";
+    std::string save_lemmas = "";
+};
+
+struct Solve_stats {
+    size_t avr_runs = 0;
+    size_t patches = 0;
+    double avr_time = 0;    // seconds spent in AVR
+    double total_time = 0;  // seconds
+    bool reused = false;    // answered by re-validating the invariant or Skolem functions of the previous solve
+    bool filtered = false;  // answered by the QBF filters, without AVR
+    bool expanded = false;  // answered by universal expansion, without AVR
+    bool bmc = false;       // answered by bounded model checking, without AVR
+};
+
+struct Solve_result {
+    AVR_result verdict = AVR_result::UNKNOWN;
+    // Skolem functions for y0 and y1 over their dependency sets (in the context of the DQBF),
+    // set for SAT instances if Solve_options::skolem
+    std::vector<z3::expr> skolem;
+    Solve_stats stats;
+};
+
+class Algorithm;
+
+// Solves a sequence of 2-DQBFs that share the prefix of p and differ in the matrix (see DQBF::read_delta).
+// The encoding, the AVR work directory and the lemmas are kept, the invariant and Skolem functions of
+// the previous SAT solve are re-validated against the edited matrix before AVR is called again.
+class Incremental_solver {
+   public:
+    Incremental_solver(DQBF& p, const Solve_options& options = Solve_options());
+    ~Incremental_solver();
+
+    // Solve p with its current matrix
+    Solve_result solve();
+
+   private:
+    DQBF& p;
+    Solve_options options;
+    std::filesystem::path work_dir;
+    bool temporary;
+    std::unique_ptr<AVR_Wrapper> avr;
+    std::unique_ptr<Algorithm> algorithm;
+    bool solved = false;
+    Circuit::lit solved_lit;
+};
+
+// Write the Skolem functions and phi as an SMT2 check (unsat iff the functions are correct)
+void save_proof(DQBF& p, const z3::expr& f_0, const z3::expr& f_1, const std::string& path);
+
+// Solve a 2-DQBF. Reentrant as long as concurrent calls use different DQBF objects and work directories.
+// Throws DQBF_error on bad input or when AVR cannot be run.
+Solve_result solve(DQBF& p, const Solve_options& options = Solve_options());
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recorder for Chrome/Perfetto trace events (chrome://tracing, ui.perfetto.dev)
+class Tracer {
+   public:
+    // Start recording, the trace is written to path at exit
+    static void enable(std::string path);
+    static bool enabled();
+
+    // Microseconds since the unix epoch
+    static int64_t now();
+
+    // Complete event ("ph": "X") on the given process/thread lane
+    static void add_span(const std::string& name, const std::string& cat, int64_t ts, int64_t dur, int pid, int tid = 0);
+    static void name_process(int pid, const std::string& name);
+
+    static void save();
+
+   private:
+    struct Event {
+        std::string name;
+        std::string cat;
+        int64_t ts;
+        int64_t dur;
+        int pid;
+        int tid;
+    };
+
+    static std::mutex mtx;
+    static std::string path;
+    static std::vector<Event> events;
+    static std::vector<std::pair<int, std::string>> process_names;
+};
+
+// Scoped timer, records a span from construction to destruction
+class Trace_Scope {
+   public:
+    Trace_Scope(std::string name, std::string cat = "solver");
+    ~Trace_Scope();
+
+   private:
+    std::string name;
+    std::string cat;
+    int64_t start;
+};
+
+#endif
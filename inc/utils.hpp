@@ -3,18 +3,62 @@
 
 #include <z3++.h>
 
+#include <functional>
+#include <istream>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
+// Errors (bad input, missing binaries, failed checks) are thrown, the caller decides whether to exit
+class DQBF_error : public std::runtime_error {
+   public:
+    using std::runtime_error::runtime_error;
+};
+
 std::vector<std::string> split_string(const std::string& str, const std::string& delim);
+
+enum class Log_level {
+    INFO,
+    WARNING,
+    ERROR,
+    AVR_STDOUT,  // output lines of AVR
+    AVR_STDERR
+};
+// Receives the messages one line at a time, possibly from several threads at once
+typedef std::function<void(Log_level, const std::string&)> Log_sink;
+// Colour-coded messages on stdout, the AVR output unchanged on stdout/stderr
+void log_to_stdout(Log_level level, const std::string& msg);
+
+// Route the messages of the current thread to sink while in scope (an empty sink drops them).
+// Outside any scope, messages go to log_to_stdout.
+class Log_scope {
+   public:
+    Log_scope(const Log_sink& sink);
+    ~Log_scope();
+
+   private:
+    const Log_sink* previous;
+};
+
+void log_message(Log_level level, const std::string& msg);
 void print_info(const char* msg);
 void print_warning(const char* msg);
 void print_error(const char* msg);
-void parse_err_msg(uint line, const char* msg);
+[[noreturn]] void parse_err_msg(uint line, const char* msg);
 
 z3::expr bool2bv(z3::expr b);
 z3::expr_vector expr2expr_vector(z3::expr e);
 z3::expr single_substitute(z3::expr e, z3::expr src, z3::expr dst);
 z3::expr bv_at(z3::expr bv, uint64_t idx);
+// Number of distinct non-leaf subterms
+size_t dag_size(z3::expr e);
 
 bool file_exists(const std::string& name);
+
+// Open an input file for streaming, .gz/.xz/.zst files are decompressed on the fly, "-" is stdin
+std::unique_ptr<std::istream> open_input(const std::string& path);
+// Format of an input file ("dqcir" or "dqdimacs") ignoring the compression extension,
+// for stdin the format is guessed from the first character of the (decompressed) stream
+std::string input_format(const std::string& path);
+std::string input_format(const std::string& path, std::istream& input);
 #endif
\ No newline at end of file
@@ -1,43 +1,119 @@
 #include "DQBF.hpp"
 
+#include <algorithm>
+#include <sstream>
+
+#include "trace.hpp"
+#include "utils.hpp"
+
 DQBF::DQBF() {
-    u_vars = std::vector<z3::expr>();
-    e_vars = std::vector<std::pair<z3::expr, std::vector<z3::expr>>>();
+    u_vars = std::vector<uint32_t>();
+    e_vars = std::vector<uint32_t>();
+}
+
+uint32_t DQBF::add_var(const std::string& name) {
+    uint32_t id = var_names.size();
+    var_names.push_back(name);
+    var_ids[name] = id;
+    circuit.add_input();
+    return id;
+}
+
+uint32_t DQBF::add_universal(const std::string& name) {
+    u_vars.push_back(add_var(name));
+    for (auto& d : e_deps) {
+        d.resize(u_vars.size());
+    }
+    var_cnt = var_names.size();
+    return u_vars.back();
+}
+
+uint32_t DQBF::add_existential(const std::string& name, const std::vector<uint32_t>& deps) {
+    boost::dynamic_bitset<> d(u_vars.size());
+    for (auto v : deps) {
+        auto it = std::find(u_vars.begin(), u_vars.end(), v);
+        if (it == u_vars.end()) {
+            throw DQBF_error("Dependency " + var_names.at(v) + " is not a universal variable");
+        }
+        d.set(it - u_vars.begin());
+    }
+    e_vars.push_back(add_var(name));
+    e_deps.push_back(d);
+    var_cnt = var_names.size();
+    return e_vars.back();
+}
+
+void DQBF::from_buffer(const std::string& text) {
+    std::istringstream input(text);
+    if (input_format("-", input) == "dqdimacs") {
+        from_dqdimacs(input);
+    } else {
+        from_dqcir(input);
+    }
+}
+
+void DQBF::set_phi(Circuit::lit root) {
+    conjuncts.clear();
+    uint32_t n = Circuit::node(root);
+    if (!Circuit::is_neg(root) && circuit.kind[n] == Circuit::AND) {
+        for (size_t i = 0; i < circuit.num_fanins(n); i++) {
+            conjuncts.push_back(circuit.fanin(n, i));
+        }
+    } else if (root != Circuit::TRUE) {
+        conjuncts.push_back(root);
+    }
+    phi_lit = root;
+    phi_expr.reset();
+}
+
+std::vector<uint32_t> DQBF::deps(size_t k) const {
+    std::vector<uint32_t> res;
+    for (size_t i = e_deps[k].find_first(); i != boost::dynamic_bitset<>::npos; i = e_deps[k].find_next(i)) {
+        res.push_back(u_vars[i]);
+    }
+    return res;
+}
+
+z3::expr DQBF::var(uint32_t id) {
+    return ctx.bool_const(var_names[id].c_str());
+}
+
+const z3::expr& DQBF::phi() {
+    if (!phi_expr) {
+        Trace_Scope scope("DQBF::phi");
+        std::vector<z3::expr> inputs;
+        for (uint32_t i = 0; i < var_names.size(); i++) {
+            inputs.push_back(var(i));
+        }
+        phi_expr = circuit.to_expr(ctx, phi_lit, inputs);
+    }
+    return *phi_expr;
 }
 
 void DQBF::print_stat(bool detailed, bool int_ver) {
     printf("-------- Stat --------\n%lu universal var(s):\n", u_vars.size());
     if (detailed) {
         if (int_ver) {
-            for (auto& x : u_vars_str) {
-                printf("%s ", x.c_str());
+            for (auto& x : u_vars) {
+                printf("%s ", var_names[x].c_str());
             }
             putchar_unlocked('\n');
         } else {
             for (auto it = u_vars.begin(); it != u_vars.end(); it++) {
-                printf("%s ", (*it).to_string().c_str());
+                printf("%s ", var(*it).to_string().c_str());
             }
             putchar_unlocked('\n');
         }
     }
     printf("%lu existential var(s):\n", e_vars.size());
     if (detailed) {
-        if (int_ver) {
-            for (auto& y : e_vars_str) {
-                printf("%s: ", y.first.c_str());
-                for (auto& x : y.second) {
-                    printf("%s ", x.c_str());
-                }
-                putchar_unlocked('\n');
-            }
-        } else {
-            for (auto it = e_vars.begin(); it != e_vars.end(); it++) {
-                printf("%s: ", (*it).first.to_string().c_str());
-                for (auto x = (*it).second.begin(); x != (*it).second.end(); x++) {
-                    printf("%s ", (*x).to_string().c_str());
-                }
-                putchar_unlocked('\n');
+        for (size_t k = 0; k < e_vars.size(); k++) {
+            printf("%s: ", int_ver ? var_names[e_vars[k]].c_str() : var(e_vars[k]).to_string().c_str());
+            for (auto& x : deps(k)) {
+                printf("%s ", int_ver ? var_names[x].c_str() : var(x).to_string().c_str());
             }
+            putchar_unlocked('\n');
         }
     }
-}
\ No newline at end of file
+    printf("%lu gate(s) in phi\n", circuit.cone_size(phi_lit));
+}
@@ -1,16 +1,36 @@
 #include "algorithm.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <ranges>
 #include <regex>
 #include <set>
+#include <sstream>
+#include <unordered_set>
 
+#include "trace.hpp"
 #include "utils.hpp"
 
 // Transform 2DQBF to a finite transition system
-Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_next(p.ctx), initial(p.ctx), transition(p.ctx), property(p.ctx), ctx(p.ctx) {
-    max_dep_size = std::max(p.e_vars[0].second.size(), p.e_vars[1].second.size());
+Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_next(p.ctx), initial(p.ctx), base_transition(p.ctx), transition(p.ctx), property(p.ctx), ctx(p.ctx), phi_decl(p.ctx), lemmas(p.ctx.bool_val(true)) {
+    Trace_Scope scope("Algorithm::Algorithm");
+    if (p.e_vars.size() != 2) {
+        throw DQBF_error("Expected exactly 2 existential variables, got " + std::to_string(p.e_vars.size()));
+    }
+    for (auto u : p.u_vars) {
+        x_str.push_back(p.var_names[u]);
+    }
+    for (int k = 0; k < 2; k++) {
+        for (auto v : p.deps(k)) {
+            z_str[k].push_back(p.var_names[v]);
+        }
+    }
+    max_dep_size = std::max(z_str[0].size(), z_str[1].size());
     register_size = 4 + p.u_vars.size() + 2 + max_dep_size;
 
     r = ctx.bv_const(".R", register_size);
@@ -28,17 +48,25 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
     idx_lookup["flag"] = 1;
     idx_lookup["k"] = 2;
     idx_lookup["y_k"] = 3;
-    for (int i = 0; i < p.u_vars_str.size(); i++) {
-        idx_lookup[p.u_vars_str[i]] = 4 + i;
+    for (int i = 0; i < x_str.size(); i++) {
+        idx_lookup[x_str[i]] = 4 + i;
     }
     idx_lookup["target k"] = 4 + p.u_vars.size();
     idx_lookup["target y_k"] = 4 + p.u_vars.size() + 1;
     idx_lookup["target z_k"] = 4 + p.u_vars.size() + 2;
 
+    slot_names.resize(register_size);
+    for (auto& [name, i] : idx_lookup) {
+        slot_names[i] = name;
+    }
+    for (int i = 0; i < max_dep_size; i++) {
+        slot_names[idx_lookup["target z_k"] + i] = "target z_k[" + std::to_string(i) + "]";
+    }
+
     // Precalculations
-    std::set<std::string> x(p.u_vars_str.begin(), p.u_vars_str.end());
-    std::set<std::string> z0(p.e_vars_str[0].second.begin(), p.e_vars_str[0].second.end());
-    std::set<std::string> z1(p.e_vars_str[1].second.begin(), p.e_vars_str[1].second.end());
+    std::set<std::string> x(x_str.begin(), x_str.end());
+    std::set<std::string> z0(z_str[0].begin(), z_str[0].end());
+    std::set<std::string> z1(z_str[1].begin(), z_str[1].end());
     std::set<std::string> z0_intersect_z1;
     std::set_intersection(z0.begin(), z0.end(), z1.begin(), z1.end(), std::inserter(z0_intersect_z1, z0_intersect_z1.end()));
     std::set<std::string> z0_minus_z1;
@@ -66,7 +94,7 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
 
     dest_1_0.push_back(!bv_at(r_next, idx_lookup["y_k"]));
     dest_1_0.push_back(bv_at(r, idx_lookup["y_k"]));
-    for (auto i : p.u_vars_str) {
+    for (auto i : x_str) {
         if (z0_minus_z1.find(i) != z0_minus_z1.end()) {
             dest_0_1.push_back(bv_at(r, idx_lookup[i]));
         } else {
@@ -84,7 +112,8 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
     for (int i = 0; i < p.var_cnt; i++) {
         s_v.push_back(ctx.bool_sort());
     }
-    z3::func_decl phi = ctx.function("phi", s_v, ctx.bool_sort());
+    phi_decl = ctx.function("phi", s_v, ctx.bool_sort());
+    z3::func_decl& phi = phi_decl;
 
     // Handy functions
     auto r_eq = [&](int i, int j) { return r.extract(i, i) == r.extract(j, j); };
@@ -107,14 +136,14 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
         // Target z_k == z_k \subseteq x
         {
             int i = 0;
-            for (auto& v : p.e_vars_str[0].second) {
+            for (auto& v : z_str[0]) {
                 tmp_2.push_back(r_next_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 i++;
             }
             tmp.push_back(z3::implies(!bv_at(r_next, idx_lookup["k"]), z3::mk_and(tmp_2)));
             tmp_2.resize(0);
             i = 0;
-            for (auto& v : p.e_vars_str[1].second) {
+            for (auto& v : z_str[1]) {
                 tmp_2.push_back(r_next_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 i++;
             }
@@ -136,7 +165,7 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
         // z_k \subseteq x == z_k' \subseteq x'
         {
             int i = 0;
-            for (auto& v : p.e_vars_str[0].second) {
+            for (auto& v : z_str[0]) {
                 tmp_2.push_back(r_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 tmp_2.push_back(r_eq_r_next(idx_lookup[v], idx_lookup[v]));
                 i++;
@@ -144,7 +173,7 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
             tmp.push_back(z3::implies(!bv_at(r, idx_lookup["k"]), z3::mk_and(tmp_2)));
             tmp_2.resize(0);
             i = 0;
-            for (auto& v : p.e_vars_str[1].second) {
+            for (auto& v : z_str[1]) {
                 tmp_2.push_back(r_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 tmp_2.push_back(r_eq_r_next(idx_lookup[v], idx_lookup[v]));
                 i++;
@@ -166,12 +195,12 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
         tmp.push_back(bv_at(r, idx_lookup["init"]));  // Init bit is not set
         // z_k \subseteq x == z_k' \subseteq x'
         {
-            for (auto& v : p.e_vars_str[0].second) {
+            for (auto& v : z_str[0]) {
                 tmp_2.push_back(r_eq_r_next(idx_lookup[v], idx_lookup[v]));
             }
             tmp.push_back(z3::implies(!bv_at(r, idx_lookup["k"]), z3::mk_and(tmp_2)));
             tmp_2.resize(0);
-            for (auto& v : p.e_vars_str[1].second) {
+            for (auto& v : z_str[1]) {
                 tmp_2.push_back(r_eq_r_next(idx_lookup[v], idx_lookup[v]));
             }
             tmp.push_back(z3::implies(bv_at(r, idx_lookup["k"]), z3::mk_and(tmp_2)));
@@ -206,6 +235,7 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
     }
 
     transition = z3::mk_or(transition_vector).simplify();
+    base_transition = transition;
 
     // Property
     z3::expr_vector property_vector(p.ctx);
@@ -217,14 +247,14 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
         // Target z_k must be the same as z_k \subseteq x
         {
             int i = 0;
-            for (auto& v : p.e_vars_str[0].second) {
+            for (auto& v : z_str[0]) {
                 tmp_2.push_back(r_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 i++;
             }
             property_vector.push_back(z3::implies(!bv_at(r, idx_lookup["k"]), z3::mk_and(tmp_2)));
             tmp_2.resize(0);
             i = 0;
-            for (auto& v : p.e_vars_str[1].second) {
+            for (auto& v : z_str[1]) {
                 tmp_2.push_back(r_eq(idx_lookup["target z_k"] + i, idx_lookup[v]));
                 i++;
             }
@@ -236,57 +266,227 @@ Algorithm::Algorithm(DQBF& p, AVR_Wrapper& avr) : avr(avr), p(p), r(p.ctx), r_ne
     property = !z3::mk_and(property_vector).simplify();
 }
 
-// Print the transition system and the property in SMT2 format
+// Rewrite equalities of 1-bit vectors of the form (ite b #b1 #b0) into equalities of Booleans
+static z3::expr bits_to_bool(z3::expr e) {
+    z3::context& ctx = e.ctx();
+    auto as_bool = [&](z3::expr t) -> std::optional<z3::expr> {
+        if (t.is_numeral()) {
+            return ctx.bool_val(t.get_numeral_uint() == 1);
+        }
+        if (t.is_app() && t.decl().decl_kind() == Z3_OP_ITE && t.arg(1).is_numeral() && t.arg(2).is_numeral()) {
+            if (t.arg(1).get_numeral_uint() == 1 && t.arg(2).get_numeral_uint() == 0) {
+                return t.arg(0);
+            } else if (t.arg(1).get_numeral_uint() == 0 && t.arg(2).get_numeral_uint() == 1) {
+                return !t.arg(0);
+            }
+        }
+        return std::nullopt;
+    };
+    std::unordered_map<unsigned, z3::expr> memo;
+    std::function<z3::expr(z3::expr)> rec = [&](z3::expr t) -> z3::expr {
+        if (!t.is_app() || t.num_args() == 0 || !t.is_bool()) {
+            return t;
+        }
+        auto it = memo.find(t.id());
+        if (it != memo.end()) {
+            return it->second;
+        }
+        z3::expr res = t;
+        if (t.decl().decl_kind() == Z3_OP_EQ && t.arg(0).is_bv() && t.arg(0).get_sort().bv_size() == 1) {
+            auto a = as_bool(t.arg(0));
+            auto b = as_bool(t.arg(1));
+            if (a && b) {
+                res = *a == *b;
+            }
+        } else {
+            z3::expr_vector args(ctx);
+            for (unsigned i = 0; i < t.num_args(); i++) {
+                args.push_back(rec(t.arg(i)));
+            }
+            res = t.decl()(args);
+        }
+        memo.emplace(t.id(), res);
+        return res;
+    };
+    return rec(e).simplify();
+}
+
+std::vector<Algorithm::State_var> Algorithm::state_vars() {
+    std::vector<State_var> vars;
+    if (encoding == Encoding::BITS) {
+        for (int i = 0; i < register_size; i++) {
+            vars.push_back({".R_" + std::to_string(i), i, i, true, false});
+        }
+    } else if (encoding == Encoding::FROZEN) {
+        vars.push_back({".R", idx_lookup["target k"] - 1, 0, false, false});
+        vars.push_back({".T", (int)register_size - 1, idx_lookup["target k"], false, true});
+    } else {
+        vars.push_back({".R", (int)register_size - 1, 0, false, false});
+    }
+    return vars;
+}
+
+z3::expr Algorithm::state_register(bool next) {
+    z3::expr_vector parts(ctx);
+    auto vars = state_vars();
+    for (auto it = vars.rbegin(); it != vars.rend(); it++) {
+        std::string name = it->name + (next ? "$next" : "");
+        parts.push_back(it->boolean ? bool2bv(ctx.bool_const(name.c_str())) : ctx.bv_const(name.c_str(), it->high - it->low + 1));
+    }
+    return parts.size() == 1 ? parts[0] : z3::concat(parts);
+}
+
+// Rewrite an expression over r and r_next into the state variables of the encoding
+z3::expr Algorithm::encode(z3::expr e) {
+    if (encoding == Encoding::INLINE_PHI) {
+        return inline_phi(e);
+    } else if (encoding == Encoding::BV) {
+        return e;
+    }
+    z3::expr_vector src(ctx);
+    z3::expr_vector dst(ctx);
+    src.push_back(r);
+    src.push_back(r_next);
+    dst.push_back(state_register(false));
+    dst.push_back(state_register(true));
+    e = e.substitute(src, dst).simplify();
+    return encoding == Encoding::BITS ? bits_to_bool(e) : e;
+}
+
+// Definition of patch i and of the disjunction .patches_i of the patches up to i
+std::string Algorithm::patch_definition(size_t i) {
+    std::ostringstream output_str;
+    std::string name = ".patch_" + std::to_string(i);
+    output_str << "; patch " << i << "\n";
+    output_str << "(define-fun " << name << " () Bool\n";
+    output_str << encode(patch_transitions[i]) << ")\n";
+    output_str << "(define-fun .patches_" << i << " () Bool ";
+    if (i == 0) {
+        output_str << name << ")\n\n";
+    } else {
+        output_str << "(or .patches_" << i - 1 << " " << name << "))\n\n";
+    }
+    return output_str.str();
+}
+
+// Print the transition system and the property in SMT2 format.
+// The transition relation is (and .frame (or .base .patches_n)), where each patch is its own define-fun
+// after the static part. If only patches were added since the last call for the same file, the file
+// is truncated after the last patch and only the new patches and the .trans definition are appended.
 void Algorithm::print_to_file(std::string path) {
+    Trace_Scope scope("Algorithm::print_to_file");
     std::ostringstream output_str;
+    z3::expr frame = lemmas.is_true() ? base_transition : base_transition && lemmas;
 
-    output_str << "; state variables\n";
-    output_str << "(declare-fun .R () (_ BitVec " << register_size << "))\n";
-    output_str << "(declare-fun .R$next () (_ BitVec " << register_size << "))\n";
-    output_str << "(define-fun ..R () (_ BitVec " << register_size << ") (! .R :next .R$next))\n\n";
+    bool append = path == emitted_path && encoding == emitted_encoding && p.phi_lit == emitted_phi_lit &&
+                  emitted_frame && z3::eq(*emitted_frame, frame) && emitted_patches <= patch_transitions.size() &&
+                  std::filesystem::exists(path) && std::filesystem::file_size(path) >= emitted_offset;
+    if (!append) {
+        output_str << "; state variables\n";
+        for (auto& v : state_vars()) {
+            std::string sort = v.boolean ? "Bool" : "(_ BitVec " + std::to_string(v.high - v.low + 1) + ")";
+            output_str << "(declare-fun " << v.name << " () " << sort << ")\n";
+            output_str << "(declare-fun " << v.name << "$next () " << sort << ")\n";
+            output_str << "(define-fun ." << v.name << " () " << sort << " (! " << v.name << " :next " << v.name << "$next))\n";
+        }
+        output_str << "\n";
 
-    output_str << "; 2DQBF phi\n";
-    output_str << "(define-fun phi (\n";
-    for (auto& e : p.e_vars) {
-        output_str << "(" << e.first << " Bool)\n";
+        // Only the matrix changes between incremental solves, the rest is cheap to print
+        if (encoding != Encoding::INLINE_PHI && (phi_text.empty() || phi_text_lit != p.phi_lit)) {
+            std::ostringstream phi_str;
+            phi_str << "; 2DQBF phi\n";
+            phi_str << "(define-fun phi (\n";
+            for (auto& e : p.e_vars) {
+                phi_str << "(" << p.var(e) << " Bool)\n";
+            }
+            for (auto& u : p.u_vars) {
+                phi_str << "(" << p.var(u) << " Bool)\n";
+            }
+            phi_str << ") Bool\n";
+            phi_str << p.phi();
+            phi_str << ")\n\n";
+            phi_text = phi_str.str();
+            phi_text_lit = p.phi_lit;
+        }
+        if (encoding != Encoding::INLINE_PHI) {
+            output_str << phi_text;
+        }
+
+        z3::expr init = encoded_initial();
+        z3::expr frame_constraint = lemmas;
+        // Frozen fields keep their value and are unconstrained initially
+        z3::expr_vector frozen(ctx);
+        for (auto& v : state_vars()) {
+            if (v.frozen) {
+                frozen.push_back(ctx.bv_const((v.name + "$next").c_str(), v.high - v.low + 1) == ctx.bv_const(v.name.c_str(), v.high - v.low + 1));
+            }
+        }
+        if (!frozen.empty()) {
+            frame_constraint = frame_constraint && z3::mk_and(frozen);
+        }
+        if (encoding != Encoding::INLINE_PHI) {
+            init = encode(init);
+        }
+
+        output_str << "; initial state\n";
+        output_str << "(define-fun .init () Bool (!\n";
+        output_str << init << "\n";
+        output_str << ":init true))\n\n";
+
+        output_str << "; property\n";
+        output_str << "(define-fun .prop () Bool (!\n";
+        output_str << (encoding == Encoding::INLINE_PHI ? property : encode(property)) << "\n";
+        output_str << " :invar-property 0))\n\n";
+
+        output_str << "; transition relation without patches, and constraints on every step\n";
+        output_str << "(define-fun .base () Bool\n";
+        output_str << encode(base_transition) << ")\n";
+        output_str << "(define-fun .frame () Bool\n";
+        output_str << encode(frame_constraint).simplify() << ")\n\n";
+
+        emitted_patches = 0;
+    }
+    for (size_t i = emitted_patches; i < patch_transitions.size(); i++) {
+        output_str << patch_definition(i);
+    }
+
+    std::ofstream output;
+    if (append) {
+        std::filesystem::resize_file(path, emitted_offset);
+        output.open(path, std::ios::app);
+    } else {
+        output.open(path);
     }
-    for (auto& u : p.u_vars) {
-        output_str << "(" << u << " Bool)\n";
-    }
-    output_str << ") Bool\n";
-    output_str << p.phi;
-    output_str << ")\n\n";
-
-    output_str << "; initial state\n";
-    output_str << "(define-fun .init () Bool (!\n";
-    output_str << initial << "\n";
-    output_str << ":init true))\n\n";
-
-    output_str << "; transition relation\n";
-    output_str << "(define-fun .trans () Bool (!\n";
-    output_str << transition << "\n";
-    output_str << " :trans true))\n\n";
-
-    output_str << "; property\n";
-    output_str << "(define-fun .prop () Bool (!\n";
-    output_str << property << "\n";
-    output_str << " :invar-property 0))\n";
-    
-    std::ofstream output(path);
     if (!output.is_open()) {
-        std::cout << "Error: Cannot open file " << path << std::endl;
-        exit(-1);
+        emitted_path = "";
+        throw DQBF_error("Cannot open file " + path);
     }
     output << output_str.str();
+    emitted_offset = output.tellp();
+
+    output << "; transition relation\n";
+    output << "(define-fun .trans () Bool (!\n";
+    if (patch_transitions.empty()) {
+        output << "(and .frame .base)\n";
+    } else {
+        output << "(and .frame (or .base .patches_" << patch_transitions.size() - 1 << "))\n";
+    }
+    output << " :trans true))\n";
     output.close();
+
+    emitted_path = path;
+    emitted_encoding = encoding;
+    emitted_phi_lit = p.phi_lit;
+    emitted_frame = frame;
+    emitted_patches = patch_transitions.size();
 }
 
 // Extract inductive invariant from the SMT2 file
 z3::expr Algorithm::extract_S(std::string inv_smt2) {
+    Trace_Scope scope("Algorithm::extract_S");
     std::ifstream inv_file(inv_smt2);
     if (!inv_file.is_open()) {
-        std::cout << "Error: Cannot open file " << inv_smt2 << std::endl;
-        exit(-1);
+        throw DQBF_error("Cannot open file " + inv_smt2);
     }
     std::string inv_prop;
     getline(inv_file, inv_prop);
@@ -299,13 +499,34 @@ z3::expr Algorithm::extract_S(std::string inv_smt2) {
 
     // Extract inductive invariant as a function of REG
     std::string decl_const = "(declare-const REG (_ BitVec " + std::to_string(register_size) + "))\n";
-    z3::expr ind_inv = z3::mk_and(p.ctx.parse_string((decl_const + "(define-fun .induct_inv ((.R (_ BitVec " + std::to_string(register_size) + "))) Bool (!\n" + inv_prop + "(assert (.induct_inv REG))").c_str())).simplify();
+    z3::expr ind_inv(ctx);
+    if (encoding == Encoding::BV || encoding == Encoding::INLINE_PHI) {
+        ind_inv = z3::mk_and(p.ctx.parse_string((decl_const + "(define-fun .induct_inv ((.R (_ BitVec " + std::to_string(register_size) + "))) Bool (!\n" + inv_prop + "(assert (.induct_inv REG))").c_str())).simplify();
+    } else {
+        // Over the state variables, which are then replaced by their bits of REG
+        z3::expr reg = p.ctx.bv_const("REG", register_size);
+        z3::expr_vector src(ctx);
+        z3::expr_vector dst(ctx);
+        for (auto& v : state_vars()) {
+            std::string sort = v.boolean ? "Bool" : "(_ BitVec " + std::to_string(v.high - v.low + 1) + ")";
+            decl_const += "(declare-const " + v.name + " " + sort + ")\n";
+            src.push_back(v.boolean ? ctx.bool_const(v.name.c_str()) : ctx.bv_const(v.name.c_str(), v.high - v.low + 1));
+            dst.push_back(v.boolean ? bv_at(reg, v.low) : reg.extract(v.high, v.low));
+        }
+        ind_inv = z3::mk_and(p.ctx.parse_string((decl_const + "(define-fun .induct_inv () Bool (!\n" + inv_prop + "(assert .induct_inv)").c_str())).substitute(src, dst).simplify();
+    }
+
+    // The seeded lemmas were used to restrict the transition relation, so they are part of the invariant
+    if (!lemmas.is_true()) {
+        ind_inv = (ind_inv && single_substitute(lemmas, r, p.ctx.bv_const("REG", register_size))).simplify();
+    }
 
     return ind_inv;
 }
 
 // Generate Skolem function from the inductive invariant
 z3::expr Algorithm::skolem_from_S(z3::expr S, int k) {
+    Trace_Scope scope("Algorithm::skolem_from_S");
     // Construct S[!X \to X] & !S[X \to !X]
     // S[!X \to X]:
     // ------------------------------------------------------------------------------------
@@ -325,16 +546,16 @@ z3::expr Algorithm::skolem_from_S(z3::expr S, int k) {
     z3::expr_vector dst_0(p.ctx);
     z3::expr_vector dst_1(p.ctx);
     for (int i = max_dep_size - 1; i >= 0; i--) {
-        dst_0.push_back(p.e_vars[k].second.size() > i ? bool2bv(p.e_vars[k].second[i]) : p.ctx.bv_val(0, 1));
-        dst_1.push_back(p.e_vars[k].second.size() > i ? bool2bv(p.e_vars[k].second[i]) : p.ctx.bv_val(0, 1));
+        dst_0.push_back(z_str[k].size() > i ? bool2bv(p.ctx.bool_const(z_str[k][i].c_str())) : p.ctx.bv_val(0, 1));
+        dst_1.push_back(z_str[k].size() > i ? bool2bv(p.ctx.bool_const(z_str[k][i].c_str())) : p.ctx.bv_val(0, 1));
     }
     dst_0.push_back(p.ctx.bv_val(1, 1));  // y_k
     dst_1.push_back(p.ctx.bv_val(0, 1));
     dst_0.push_back(p.ctx.bv_val(k, 1));  // k
     dst_1.push_back(p.ctx.bv_val(k, 1));
     for (auto& s : p.u_vars | std::ranges::views::reverse) {
-        dst_0.push_back(bool2bv(s));
-        dst_1.push_back(bool2bv(s));
+        dst_0.push_back(bool2bv(p.var(s)));
+        dst_1.push_back(bool2bv(p.var(s)));
     }
     dst_0.push_back(p.ctx.bv_val(0, 1));  // y_k
     dst_1.push_back(p.ctx.bv_val(1, 1));
@@ -349,8 +570,8 @@ z3::expr Algorithm::skolem_from_S(z3::expr S, int k) {
     z3::expr S_neg_X_to_X = single_substitute(S, p.ctx.bv_const("REG", register_size), z3::concat(dst_1));  // S[!X -> X]
     z3::expr f = S_neg_X_to_X && (!S_X_to_neg_X);
     
-    std::set<std::string> x(p.u_vars_str.begin(), p.u_vars_str.end());
-    std::set<std::string> zk(p.e_vars_str[k].second.begin(), p.e_vars_str[k].second.end());
+    std::set<std::string> x(x_str.begin(), x_str.end());
+    std::set<std::string> zk(z_str[k].begin(), z_str[k].end());
     std::set<std::string> x_minus_zk;
     std::set_difference(x.begin(), x.end(), zk.begin(), zk.end(), std::inserter(x_minus_zk, x_minus_zk.end()));
     for (auto& v : x_minus_zk) {
@@ -359,7 +580,73 @@ z3::expr Algorithm::skolem_from_S(z3::expr S, int k) {
     return f;
 }
 
-void Algorithm::patch(z3::model counterexample) {
+Patch_cube Algorithm::cube_from_model(z3::model counterexample) {
+    Patch_cube cube;
+    cube.y_0 = counterexample.eval(p.var(p.e_vars[0]), true).bool_value() == Z3_L_TRUE;
+    for (auto& v : z_str[0]) {
+        cube.z_0.emplace_back(v, counterexample.eval(p.ctx.bool_const(v.c_str()), true).bool_value() == Z3_L_TRUE);
+    }
+    return cube;
+}
+
+// Shrink the point cube of a counterexample to a subset of its z_0 literals under which y_0 = v fails
+// for every extension: f_0 = v and phi is false with y_1 = f_1. The literals are taken from an unsat core
+// and then dropped one by one. If the point itself has an extension that is not a counterexample,
+// the point cube is kept.
+Patch_cube Algorithm::generalise(const Patch_cube& cube, const z3::expr& f_0, const z3::expr& f_1) {
+    Trace_Scope scope("Algorithm::generalise");
+    z3::expr y_0 = p.var(p.e_vars[0]);
+    z3::expr y_1 = p.var(p.e_vars[1]);
+    z3::solver solver(ctx);
+    z3::params params(ctx);
+    params.set("timeout", 1000u);
+    solver.set(params);
+    solver.add(y_0 == ctx.bool_val(cube.y_0));
+    solver.add(y_1 == f_1);
+    solver.add(f_0 != y_0 || p.phi());
+
+    z3::expr_vector literals(ctx);
+    for (auto& [v, value] : cube.z_0) {
+        literals.push_back(value ? ctx.bool_const(v.c_str()) : !ctx.bool_const(v.c_str()));
+    }
+    if (solver.check(literals) != z3::unsat) {
+        return cube;
+    }
+    z3::expr_vector core = solver.unsat_core();
+    std::vector<z3::expr> kept;
+    for (auto l : core) {
+        kept.push_back(l);
+    }
+    for (size_t i = 0; i < kept.size();) {
+        z3::expr_vector assumptions(ctx);
+        for (size_t j = 0; j < kept.size(); j++) {
+            if (j != i) {
+                assumptions.push_back(kept[j]);
+            }
+        }
+        if (solver.check(assumptions) == z3::unsat) {
+            kept.erase(kept.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    Patch_cube res;
+    res.y_0 = cube.y_0;
+    for (size_t i = 0; i < cube.z_0.size(); i++) {
+        for (auto& l : kept) {
+            if (z3::eq(l, literals[i])) {
+                res.z_0.push_back(cube.z_0[i]);
+            }
+        }
+    }
+    print_info(("Patch cube over " + std::to_string(res.z_0.size()) + " of " + std::to_string(cube.z_0.size()) + " z0 literal(s)").c_str());
+    return res;
+}
+
+// Add a transition from y_0 = v to y_0 = !v (k = 0) inside the cube, so that the invariant must choose !v there
+void Algorithm::patch(const Patch_cube& cube) {
+    Trace_Scope scope("Algorithm::patch");
     z3::expr_vector tmp(p.ctx);
     tmp.push_back(bv_at(r, idx_lookup["init"]));
     tmp.push_back(bv_at(r_next, idx_lookup["init"]));
@@ -369,7 +656,7 @@ void Algorithm::patch(z3::model counterexample) {
     tmp.push_back(!bv_at(r, idx_lookup["k"]));
     tmp.push_back(!bv_at(r_next, idx_lookup["k"]));
 
-    if (counterexample.eval(p.e_vars[0].first, true).bool_value() == Z3_L_TRUE) {
+    if (cube.y_0) {
         tmp.push_back(!bv_at(r, idx_lookup["y_k"]));
         tmp.push_back(bv_at(r_next, idx_lookup["y_k"]));
     } else {
@@ -377,12 +664,12 @@ void Algorithm::patch(z3::model counterexample) {
         tmp.push_back(!bv_at(r_next, idx_lookup["y_k"]));
     }
 
-    for (auto& v : p.e_vars_str[0].second) {
-        if (counterexample.eval(p.ctx.bool_const(v.c_str()), true).bool_value() == Z3_L_TRUE) {
-            tmp.push_back(bv_at(r, idx_lookup[v]));
-        } else {
-            tmp.push_back(!bv_at(r, idx_lookup[v]));
+    for (auto& [v, value] : cube.z_0) {
+        auto it = idx_lookup.find(v);
+        if (it == idx_lookup.end() || std::find(z_str[0].begin(), z_str[0].end(), v) == z_str[0].end()) {
+            throw DQBF_error("Patch over " + v + ", which is not in the dependency set of y0");
         }
+        tmp.push_back(value ? bv_at(r, it->second) : !bv_at(r, it->second));
     }
 
     for (int i = idx_lookup["y_k"] + 1; i < register_size; i++) {
@@ -390,98 +677,1024 @@ void Algorithm::patch(z3::model counterexample) {
     }
 
     transition = transition || z3::mk_and(tmp);
+    patch_transitions.push_back(z3::mk_and(tmp));
     tmp.resize(0);
+    patches.push_back(cube);
+
+    if (!seed_lemmas.empty()) {
+        filter_lemmas();
+    }
+}
+
+// The patches, the refinement iteration and the clauses of the last invariant that are still inductive
+// after the patches (over REG), as SMT2 with the patches in comments. Written to a temporary file first,
+// so that a preempted write leaves the old one.
+void Algorithm::save_checkpoint(const z3::expr& S, std::string path) {
+    Trace_Scope scope("Algorithm::save_checkpoint");
+    z3::expr reg = p.ctx.bv_const("REG", register_size);
+    z3::expr S_r = single_substitute(S, reg, r).simplify();
+    std::vector<z3::expr> clauses;
+    if (S_r.is_and()) {
+        for (unsigned i = 0; i < S_r.num_args(); i++) {
+            clauses.push_back(S_r.arg(i));
+        }
+    } else {
+        clauses.push_back(S_r);
+    }
+    z3::expr_vector kept(ctx);
+    for (auto& c : inductive_subset(clauses)) {
+        kept.push_back(single_substitute(c, r, reg));
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream output(tmp_path);
+    if (!output.is_open()) {
+        print_warning(("Cannot open file " + tmp_path + ", no checkpoint is written").c_str());
+        return;
+    }
+    output << "; 2DQR checkpoint\n";
+    output << "; instance " << fingerprint() << "\n";
+    output << "; iteration " << iteration << "\n";
+    for (auto& cube : patches) {
+        output << "; patch " << cube.y_0;
+        for (auto& [v, value] : cube.z_0) {
+            output << " " << v << "=" << value;
+        }
+        output << "\n";
+    }
+    output << "(declare-const REG (_ BitVec " << register_size << "))\n";
+    std::string str = kept.empty() ? "true" : z3::mk_and(kept).to_string();
+    std::replace(str.begin(), str.end(), '\n', ' ');
+    output << "(assert " << str << ")\n";
+    output.close();
+    std::filesystem::rename(tmp_path, path);
+}
+
+// Hash of the prefix (variable names and dependency sets) and the matrix, so that a checkpoint
+// is only resumed on the instance it was written for
+std::string Algorithm::fingerprint() {
+    size_t h = 0;
+    for (auto v : p.u_vars) {
+        boost::hash_combine(h, p.var_names[v]);
+    }
+    for (size_t k = 0; k < p.e_vars.size(); k++) {
+        boost::hash_combine(h, p.var_names[p.e_vars[k]]);
+        for (auto v : p.deps(k)) {
+            boost::hash_combine(h, p.var_names[v]);
+        }
+    }
+    boost::hash_combine(h, p.phi().to_string());
+    std::ostringstream s;
+    s << std::hex << h;
+    return s.str();
+}
+
+void Algorithm::resume(std::string path) {
+    Trace_Scope scope("Algorithm::resume");
+    std::ifstream input(path);
+    if (!input.is_open()) {
+        print_warning(("Cannot open checkpoint " + path + ", starting from scratch").c_str());
+        return;
+    }
+    std::string line;
+    std::string smt2;
+    std::vector<Patch_cube> cubes;
+    size_t saved_iteration = 0;
+    std::string instance;
+    while (getline(input, line)) {
+        std::vector<std::string> parts = split_string(line, " =");
+        if (parts.size() >= 3 && parts[0] == ";" && parts[1] == "instance") {
+            instance = parts[2];
+        } else if (parts.size() >= 3 && parts[0] == ";" && parts[1] == "iteration") {
+            saved_iteration = std::stoul(parts[2]);
+        } else if (parts.size() >= 3 && parts[0] == ";" && parts[1] == "patch") {
+            Patch_cube cube;
+            cube.y_0 = parts[2] == "1";
+            for (size_t i = 3; i + 1 < parts.size(); i += 2) {
+                cube.z_0.emplace_back(parts[i], parts[i + 1] == "1");
+            }
+            cubes.push_back(cube);
+        } else if (line.rfind(";", 0) != 0) {
+            smt2 += line + "\n";
+        }
+    }
+    if (instance != fingerprint()) {
+        throw DQBF_error("Checkpoint " + path + " was written for another instance");
+    }
+    z3::expr S(ctx);
+    try {
+        S = z3::mk_and(ctx.parse_string(smt2.c_str()));
+    } catch (const z3::exception& e) {
+        throw DQBF_error("Cannot parse checkpoint " + path + ": " + e.msg());
+    }
+    if (smt2.find("(_ BitVec " + std::to_string(register_size) + ")") == std::string::npos) {
+        throw DQBF_error("Checkpoint " + path + " does not match the register of this instance");
+    }
+
+    transition = base_transition;
+    patches.clear();
+    patch_transitions.clear();
+    for (auto& cube : cubes) {
+        patch(cube);
+    }
+    iteration = saved_iteration;
+    resumed = true;
+    last_S = S;
+    // The saved clauses seed the next AVR run, in case they are not an invariant on their own
+    z3::expr S_r = single_substitute(S, p.ctx.bv_const("REG", register_size), r).simplify();
+    if (S_r.is_and()) {
+        for (unsigned i = 0; i < S_r.num_args(); i++) {
+            seed_lemmas.push_back(S_r.arg(i));
+        }
+    } else if (!S_r.is_true()) {
+        seed_lemmas.push_back(S_r);
+    }
+    size_t kept = filter_lemmas();
+    print_info(("Resumed from " + path + ": iteration " + std::to_string(iteration) + ", " + std::to_string(patches.size()) + " patch(es), " +
+                std::to_string(kept) + " inductive lemma(s)").c_str());
+}
+
+// Replace the applications of the uninterpreted function phi by the matrix
+z3::expr Algorithm::inline_phi(z3::expr e) {
+    z3::expr_vector params(ctx);
+    for (auto& v : p.e_vars) {
+        params.push_back(p.var(v));
+    }
+    for (auto& v : p.u_vars) {
+        params.push_back(p.var(v));
+    }
+    z3::expr body = p.phi();
+    std::unordered_map<unsigned, z3::expr> memo;
+    std::function<z3::expr(z3::expr)> rec = [&](z3::expr e) -> z3::expr {
+        if (!e.is_app() || e.num_args() == 0) {
+            return e;
+        }
+        auto it = memo.find(e.id());
+        if (it != memo.end()) {
+            return it->second;
+        }
+        z3::expr_vector args(ctx);
+        for (unsigned i = 0; i < e.num_args(); i++) {
+            args.push_back(rec(e.arg(i)));
+        }
+        z3::expr res = z3::eq(e.decl(), phi_decl) ? body.substitute(params, args) : e.decl()(args);
+        memo.emplace(e.id(), res);
+        return res;
+    };
+    return rec(e);
+}
+
+// The register as a concatenation of Boolean variables named after its fields
+z3::expr Algorithm::named_register() {
+    z3::expr_vector bits(ctx);
+    for (int i = register_size - 1; i >= 0; i--) {
+        bits.push_back(bool2bv(ctx.bool_const(slot_names[i].c_str())));
+    }
+    return z3::concat(bits);
+}
+
+// Initial states of the emitted encoding, over r: the frozen target fields are unconstrained
+z3::expr Algorithm::encoded_initial() {
+    if (encoding == Encoding::FROZEN) {
+        return r.extract(idx_lookup["target k"] - 1, 0) == ctx.bv_val(0, idx_lookup["target k"]);
+    }
+    return initial;
+}
+
+// Largest subset of candidates (over r) that holds in the initial states of the encoding
+// and is inductive for the current transition relation (Houdini)
+std::vector<z3::expr> Algorithm::inductive_subset(const std::vector<z3::expr>& candidates) {
+    Trace_Scope scope("Algorithm::inductive_subset");
+    std::vector<z3::expr> kept;
+    z3::solver init_solver(ctx);
+    init_solver.add(encoded_initial());
+    for (auto& l : candidates) {
+        if (init_solver.check(expr2expr_vector(!l)) == z3::unsat) {
+            kept.push_back(l);
+        }
+    }
+
+    z3::solver solver(ctx);
+    solver.add(inline_phi(transition));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        solver.push();
+        for (auto& l : kept) {
+            solver.add(l);
+        }
+        std::vector<z3::expr> next;
+        for (auto& l : kept) {
+            if (solver.check(expr2expr_vector(!single_substitute(l, r, r_next))) == z3::unsat) {
+                next.push_back(l);
+            } else {
+                changed = true;
+            }
+        }
+        solver.pop();
+        kept = next;
+    }
+    return kept;
+}
+
+// Keep the inductive subset of the seed lemmas
+size_t Algorithm::filter_lemmas() {
+    Trace_Scope scope("Algorithm::filter_lemmas");
+    lemmas_encoding = encoding;
+    std::vector<z3::expr> kept = inductive_subset(seed_lemmas);
+    z3::expr_vector v(ctx);
+    for (auto& l : kept) {
+        v.push_back(l);
+    }
+    lemmas = z3::mk_and(v).simplify();
+    return kept.size();
+}
+
+// Name of the bit of target z_k that holds v when target k is k, in lemma files
+std::string Algorithm::target_name(int k, const std::string& v) {
+    return "target z" + std::to_string(k) + "[" + v + "]";
+}
+
+// Whether e contains one of the constants
+static bool mentions(const z3::expr& e, const std::unordered_set<unsigned>& constants) {
+    std::unordered_set<unsigned> seen;
+    std::vector<z3::expr> stack = {e};
+    while (!stack.empty()) {
+        z3::expr t = stack.back();
+        stack.pop_back();
+        if (!seen.insert(t.id()).second) {
+            continue;
+        }
+        if (constants.count(t.id())) {
+            return true;
+        }
+        if (t.is_app()) {
+            for (unsigned i = 0; i < t.num_args(); i++) {
+                stack.push_back(t.arg(i));
+            }
+        }
+    }
+    return false;
+}
+
+// Save the clauses of the invariant over the named register fields, one per line
+void Algorithm::save_lemmas(z3::expr S, std::string path) {
+    Trace_Scope scope("Algorithm::save_lemmas");
+    z3::expr named = single_substitute(S, p.ctx.bv_const("REG", register_size), named_register()).simplify();
+    z3::expr_vector clauses(ctx);
+    if (named.is_and()) {
+        for (unsigned i = 0; i < named.num_args(); i++) {
+            clauses.push_back(named.arg(i));
+        }
+    } else {
+        clauses.push_back(named);
+    }
+
+    // Bit i of target z_k is the i-th variable of z0 or z1, depending on target k. Each clause is split on
+    // target k and the bits are named after the variables ("target z0[x3]"), cofactors over bits past
+    // the end of the dependency set are dropped.
+    z3::expr target_k = ctx.bool_const(slot_names[idx_lookup["target k"]].c_str());
+    std::unordered_set<unsigned> target_bits;
+    for (size_t i = 0; i < max_dep_size; i++) {
+        target_bits.insert(ctx.bool_const(slot_names[idx_lookup["target z_k"] + i].c_str()).id());
+    }
+    std::unordered_set<unsigned> padding;
+    std::vector<z3::expr> keyed;
+    for (auto c : clauses) {
+        if (!mentions(c, target_bits)) {
+            keyed.push_back(c);
+            continue;
+        }
+        for (int k = 0; k < 2; k++) {
+            z3::expr_vector src(ctx);
+            z3::expr_vector dst(ctx);
+            src.push_back(target_k);
+            dst.push_back(ctx.bool_val(k == 1));
+            padding.clear();
+            for (size_t i = 0; i < max_dep_size; i++) {
+                z3::expr bit = ctx.bool_const(slot_names[idx_lookup["target z_k"] + i].c_str());
+                if (i < z_str[k].size()) {
+                    src.push_back(bit);
+                    dst.push_back(ctx.bool_const(target_name(k, z_str[k][i]).c_str()));
+                } else {
+                    padding.insert(bit.id());
+                }
+            }
+            z3::expr c_k = c.substitute(src, dst).simplify();
+            if (!c_k.is_true() && !mentions(c_k, padding)) {
+                keyed.push_back(k == 0 ? target_k || c_k : !target_k || c_k);
+            }
+        }
+    }
+
+    std::ofstream output(path);
+    if (!output.is_open()) {
+        print_warning(("Cannot open file " + path + ", lemmas are not saved").c_str());
+        return;
+    }
+    output << "; 2DQR lemmas, register bits are named after the fields of the encoding\n";
+    for (int i = 0; i < idx_lookup["target z_k"]; i++) {
+        output << "(declare-const " << ctx.bool_const(slot_names[i].c_str()) << " Bool)\n";
+    }
+    for (int k = 0; k < 2; k++) {
+        for (auto& v : z_str[k]) {
+            output << "(declare-const " << ctx.bool_const(target_name(k, v).c_str()) << " Bool)\n";
+        }
+    }
+    int cnt = 0;
+    for (auto c : keyed) {
+        std::string str = c.to_string();
+        std::replace(str.begin(), str.end(), '\n', ' ');
+        output << "(assert " << str << ")\n";
+        cnt++;
+    }
+    output.close();
+    print_info(("Saved " + std::to_string(cnt) + " lemma(s) to " + path).c_str());
+}
+
+void Algorithm::load_lemmas(std::string path) {
+    Trace_Scope scope("Algorithm::load_lemmas");
+    std::ifstream input(path);
+    if (!input.is_open()) {
+        print_warning(("Cannot open file " + path + ", starting without lemmas").c_str());
+        return;
+    }
+    std::string decls;
+    z3::expr_vector src(ctx);
+    z3::expr_vector dst(ctx);
+    auto declare = [&](const std::string& name, int i) {
+        z3::expr v = ctx.bool_const(name.c_str());
+        decls += "(declare-const " + v.to_string() + " Bool)\n";
+        src.push_back(v);
+        dst.push_back(bv_at(r, i));
+    };
+    for (int i = 0; i < idx_lookup["target z_k"]; i++) {
+        declare(slot_names[i], i);
+    }
+    // The lemmas on target z_k are split on target k (see save_lemmas)
+    for (int k = 0; k < 2; k++) {
+        for (size_t i = 0; i < z_str[k].size(); i++) {
+            declare(target_name(k, z_str[k][i]), idx_lookup["target z_k"] + i);
+        }
+    }
+
+    // Lemmas over fields that do not exist in this instance (e.g. other universal variables) are skipped.
+    // They are parsed in a scratch context, which is replaced after an error because z3 keeps reporting
+    // the error on every later parse in the same context.
+    size_t unknown = 0;
+    auto scratch = std::make_unique<z3::context>();
+    std::string line;
+    while (getline(input, line)) {
+        if (line.rfind("(assert", 0) != 0) {
+            continue;
+        }
+        try {
+            z3::expr_vector v(ctx, scratch->parse_string((decls + line).c_str()));
+            for (auto e : v) {
+                seed_lemmas.push_back(e.substitute(src, dst));
+            }
+        } catch (z3::exception& e) {
+            unknown++;
+            scratch = std::make_unique<z3::context>();
+        }
+    }
+    size_t kept = filter_lemmas();
+    print_info(("Loaded " + std::to_string(seed_lemmas.size() + unknown) + " lemma(s), " + std::to_string(unknown) + " over unknown variables, " + std::to_string(kept) + " inductive").c_str());
+}
+
+// Merge the equivalent nodes of f and g (jointly, so that they can share nodes)
+z3::expr Algorithm::fraig(z3::expr f, z3::expr g, z3::expr& g_out) {
+    Trace_Scope scope("Algorithm::fraig");
+    Circuit c;
+    std::unordered_map<unsigned, Circuit::lit> inputs;
+    std::vector<z3::expr> vars;
+    for (auto& u : p.u_vars) {
+        vars.push_back(p.var(u));
+        inputs[vars.back().id()] = c.add_input();
+    }
+    std::vector<Circuit::lit> roots = {c.add_expr(f, inputs), c.add_expr(g, inputs)};
+    Circuit res = c.fraig(roots, ctx);
+    g_out = res.to_expr(ctx, roots[1], vars);
+    return res.to_expr(ctx, roots[0], vars);
+}
+
+// Shrink the Skolem functions using phi as the care set:
+// - SAT sweeping merges equivalent nodes
+// - subterms, top-level ones (the cubes of the patches) first, are replaced by constants
+//   as long as the functions still satisfy phi
+// All checks together take at most time_limit_ms
+void Algorithm::minimise_skolem(z3::expr& f_0, z3::expr& f_1, z3::solver& solver, unsigned time_limit_ms) {
+    Trace_Scope scope("Algorithm::minimise_skolem");
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(time_limit_ms);
+    auto remaining = [&]() -> unsigned {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return ms > 0 ? ms : 0;
+    };
+    z3::expr y_0 = p.var(p.e_vars[0]);
+    z3::expr y_1 = p.var(p.e_vars[1]);
+    z3::expr g_0 = f_0.simplify();
+    z3::expr g_1 = f_1.simplify();
+    size_t before = dag_size(f_0) + dag_size(f_1);
+
+    auto sweep = [&]() {
+        try {
+            g_0 = fraig(g_0, g_1, g_1);
+        } catch (const std::invalid_argument& e) {
+            print_warning(("SAT sweeping skipped: " + std::string(e.what())).c_str());
+        }
+    };
+    sweep();
+
+    // Each check may give up, a replacement is only kept if the check succeeds.
+    // A quarter of the time limit is left for the final check.
+    z3::params params(ctx);
+    unsigned reserve = time_limit_ms / 4;
+    int budget = 1000;
+    for (int k = 0; k < 2; k++) {
+        z3::expr& g = k == 0 ? g_0 : g_1;
+        std::vector<z3::expr> queue = {g};
+        std::unordered_set<unsigned> seen;
+        for (size_t i = 0; i < queue.size() && budget > 0 && remaining() > reserve; i++) {
+            z3::expr t = queue[i];
+            if (!t.is_app() || t.is_true() || t.is_false() || !seen.insert(t.id()).second) {
+                continue;
+            }
+            bool replaced = false;
+            for (bool value : {false, true}) {
+                z3::expr candidate = single_substitute(g, t, ctx.bool_val(value));
+                if (z3::eq(candidate, g)) {
+                    continue;
+                }
+                budget--;
+                unsigned left = remaining();
+                params.set("timeout", left > reserve ? std::min(1000u, left - reserve) : 1u);
+                solver.set(params);
+                z3::expr h_0 = k == 0 ? candidate : g_0;
+                z3::expr h_1 = k == 1 ? candidate : g_1;
+                if (solver.check(expr2expr_vector((y_0 == h_0) && (y_1 == h_1))) == z3::unsat) {
+                    g = candidate;
+                    replaced = true;
+                    break;
+                }
+            }
+            if (!replaced) {
+                for (unsigned j = 0; j < t.num_args(); j++) {
+                    if (t.arg(j).is_bool()) {
+                        queue.push_back(t.arg(j));
+                    }
+                }
+            }
+        }
+    }
+    params.set("timeout", std::max(1000u, remaining()));
+    solver.set(params);
+    g_0 = g_0.simplify();
+    g_1 = g_1.simplify();
+    sweep();
+
+    // Keep the original functions if the final check does not go through
+    z3::check_result check = solver.check(expr2expr_vector((y_0 == g_0) && (y_1 == g_1)));
+    params.set("timeout", UINT_MAX);
+    solver.set(params);
+    if (check != z3::unsat) {
+        print_warning("Minimised Skolem functions could not be checked, keeping the original ones");
+        return;
+    }
+    f_0 = g_0;
+    f_1 = g_1;
+    print_info(("Skolem functions minimised: " + std::to_string(before) + " -> " + std::to_string(dag_size(f_0) + dag_size(f_1)) + " nodes").c_str());
 }
 
 void Algorithm::dependencies_check(z3::expr& f_0, z3::expr& f_1) {
+    Trace_Scope scope("Algorithm::dependencies_check");
     z3::solver solver(p.ctx);
     z3::expr_vector x_vars(p.ctx);
     z3::expr_vector x_vars_p(p.ctx);
-    for (auto& v : p.u_vars_str) {
+    for (auto& v : x_str) {
         x_vars_p.push_back(p.ctx.bool_const((v + "$prime").c_str()));
         x_vars.push_back(p.ctx.bool_const(v.c_str()));
     }
 
     z3::expr_vector src(p.ctx);
     z3::expr_vector dst(p.ctx);
-    for (auto& v : p.e_vars_str[0].second) {
+    for (auto& v : z_str[0]) {
         src.push_back(p.ctx.bool_const((v + "$prime").c_str()));
         dst.push_back(p.ctx.bool_const(v.c_str()));
     }
     z3::expr f_0_p = f_0.substitute(x_vars, x_vars_p).substitute(src, dst);
     src.resize(0);
     dst.resize(0);
-    for (auto& v : p.e_vars_str[1].second) {
+    for (auto& v : z_str[1]) {
         src.push_back(p.ctx.bool_const((v + "$prime").c_str()));
         dst.push_back(p.ctx.bool_const(v.c_str()));
     }
     z3::expr f_1_p = f_1.substitute(x_vars, x_vars_p).substitute(src, dst);
 
     solver.add((f_0 != f_0_p) && (f_1 != f_1_p));
-    assert(solver.check() == z3::unsat);
+    if (solver.check() != z3::unsat) {
+        throw DQBF_error("Skolem functions violate the dependencies");
+    }
 }
 
-void Algorithm::save_proof(z3::expr& f_0, z3::expr& f_1, std::string path) {
-    std::ofstream proof(path);
-    proof << "; Declare variables\n";
-    for (auto& u : p.u_vars) {
-        proof << "(declare-const " << u << " Bool)\n";
-    }
-    proof << "\n";
-
-    proof << "; Skolem function for y0\n";
-    proof << "(define-fun " + p.e_vars_str[0].first + " () Bool\n";
-    proof << f_0.simplify();
-    proof << ")\n\n";
-
-    proof << "; Skolem function for y1\n";
-    proof << "(define-fun " + p.e_vars_str[1].first + " () Bool\n";
-    proof << f_1.simplify();
-    proof << ")\n\n";
-
-    proof << "; 2DQBF phi\n";
-    proof << "(define-fun phi () Bool\n";
-    proof << p.phi.simplify();
-    proof << ")\n\n";
-
-    proof << "(assert (not phi))\n(check-sat)";
-    proof.close();
-};
-
-void Algorithm::run(bool gen_skolem) {
-    print_info("Solving");
-    print_to_file("./transform.smt2");
-    // check_avr();
-    AVR_result result = avr.run_avr("./transform.smt2");
-    assert(result != AVR_result::UNKNOWN);
+void Algorithm::matrix_changed() {
+    Trace_Scope scope("Algorithm::matrix_changed");
+    transition = base_transition;
+    patches.clear();
+    patch_transitions.clear();
+    iteration = 0;
+    resumed = false;
+    if (!seed_lemmas.empty()) {
+        filter_lemmas();
+    }
+}
+
+// Check that the invariant of a previous run still proves the property for the current matrix
+bool Algorithm::S_still_inductive(z3::expr S) {
+    Trace_Scope scope("Algorithm::S_still_inductive");
+    z3::expr reg = p.ctx.bv_const("REG", register_size);
+    z3::expr S_r = single_substitute(S, reg, r);
+    z3::expr S_r_next = single_substitute(S, reg, r_next);
+    z3::solver solver(ctx);
+    if (solver.check(expr2expr_vector(initial && !S_r)) != z3::unsat) {
+        return false;
+    }
+    if (solver.check(expr2expr_vector(S_r && !property)) != z3::unsat) {
+        return false;
+    }
+    solver.add(inline_phi(transition));
+    return solver.check(expr2expr_vector(S_r && !S_r_next)) == z3::unsat;
+}
+
+// Decide the instance by QBF relaxations, each check is limited to timeout ms:
+// - UNSAT if forall x exists y0 y1. phi is false
+// - SAT if exists y0 y1 forall R. phi holds for every assignment of D = z0 & z1, where R = x \ D.
+//   The Skolem functions pick the first (y0, y1) in the order 00, 01, 10, 11 for which forall R. phi
+//   holds, computed by quantifier elimination. With skolem, UNKNOWN if that does not finish in time.
+AVR_result Algorithm::qbf_filters(unsigned timeout, bool skolem, std::vector<z3::expr>& f) {
+    Trace_Scope scope("Algorithm::qbf_filters");
+    z3::params params(ctx);
+    params.set("timeout", timeout);
+    z3::expr_vector y(ctx);
+    y.push_back(p.var(p.e_vars[0]));
+    y.push_back(p.var(p.e_vars[1]));
+    z3::expr body = p.phi();
+    std::vector<z3::expr> phi_ab;
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 2; b++) {
+            z3::expr_vector val(ctx);
+            val.push_back(ctx.bool_val(a));
+            val.push_back(ctx.bool_val(b));
+            phi_ab.push_back(body.substitute(y, val));
+        }
+    }
+
+    z3::solver solver(ctx);
+    solver.set(params);
+    for (auto& e : phi_ab) {
+        solver.add(!e);
+    }
+    if (solver.check() == z3::sat) {
+        print_info("UNSAT by the QBF filter: some x has no (y0, y1)");
+        return AVR_result::UNSAT;
+    }
+
+    // Four copies of R, one for each value of (y0, y1)
+    std::set<std::string> z1(z_str[1].begin(), z_str[1].end());
+    z3::expr_vector R(ctx);
+    for (auto& v : z_str[0]) {
+        if (!z1.count(v)) {
+            R.push_back(ctx.bool_const(v.c_str()));
+        }
+    }
+    std::set<std::string> z0(z_str[0].begin(), z_str[0].end());
+    for (auto& v : x_str) {
+        if (!z0.count(v)) {
+            R.push_back(ctx.bool_const(v.c_str()));
+        }
+    }
+    solver.reset();
+    solver.set(params);
+    for (int ab = 0; ab < 4; ab++) {
+        z3::expr_vector copy(ctx);
+        for (auto v : R) {
+            copy.push_back(ctx.bool_const((v.to_string() + "$" + std::to_string(ab)).c_str()));
+        }
+        solver.add(!phi_ab[ab].substitute(R, copy));
+    }
+    if (solver.check() != z3::unsat) {
+        return AVR_result::UNKNOWN;
+    }
+    // The instance is SAT from here on. With skolem, the verdict is only returned together with
+    // the Skolem functions, otherwise the instance is left to AVR for a certificate.
+    if (skolem) {
+        try {
+            z3::tactic qe = z3::try_for(z3::tactic(ctx, "qe") & z3::tactic(ctx, "simplify"), timeout);
+            std::vector<z3::expr> g;
+            for (auto& e : phi_ab) {
+                z3::goal goal(ctx);
+                goal.add(R.empty() ? e : z3::forall(R, e));
+                z3::apply_result r = qe(goal);
+                if (r.size() != 1) {
+                    throw z3::exception("quantifier elimination did not return a single goal");
+                }
+                g.push_back(r[0].as_expr());
+            }
+            f = {!g[0] && !g[1], !g[0] && (g[1] || !g[2])};
+        } catch (const z3::exception& e) {
+            print_warning(("No Skolem functions from the QBF filter, solving with AVR: " + std::string(e.msg())).c_str());
+            return AVR_result::UNKNOWN;
+        }
+    }
+    print_info("SAT by the QBF filter: (y0, y1) only needs z0 & z1");
+    return AVR_result::SAT;
+}
+
+// Split the universals into D = z0 ∩ z1, A = z0 \ z1, B = z1 \ z0 and R = x \ (z0 ∪ z1)
+void Algorithm::expansion_sets(z3::expr_vector& D, z3::expr_vector& A, z3::expr_vector& B, z3::expr_vector& R) {
+    std::set<std::string> z0(z_str[0].begin(), z_str[0].end());
+    std::set<std::string> z1(z_str[1].begin(), z_str[1].end());
+    for (auto& v : z_str[0]) {
+        if (z1.count(v)) {
+            D.push_back(ctx.bool_const(v.c_str()));
+        } else {
+            A.push_back(ctx.bool_const(v.c_str()));
+        }
+    }
+    for (auto& v : z_str[1]) {
+        if (!z0.count(v)) {
+            B.push_back(ctx.bool_const(v.c_str()));
+        }
+    }
+    for (auto& v : x_str) {
+        if (!z0.count(v) && !z1.count(v)) {
+            R.push_back(ctx.bool_const(v.c_str()));
+        }
+    }
+}
+
+// Size of the expansion: 2^(|A| + |B| + |R|) copies of phi
+size_t Algorithm::expansion_size() {
+    z3::expr_vector D(ctx), A(ctx), B(ctx), R(ctx);
+    expansion_sets(D, A, B, R);
+    size_t exponent = A.size() + B.size() + R.size();
+    size_t dag = std::max<size_t>(p.circuit.cone_size(p.phi_lit), 1);
+    if (exponent >= 48 || (SIZE_MAX >> exponent) < dag) {
+        return SIZE_MAX;
+    }
+    return dag << exponent;
+}
+
+// Decide p by expanding the universals outside D: y0 gets a copy per assignment of A, y1 per assignment
+// of B and phi a copy per assignment of A, B and R. The conjunction psi of the copies leaves the 2QBF
+// ∀D ∃copies. psi, which is solved by counterexample-guided refinement: a candidate for D falsifies psi
+// for all sampled copy values so far, and either has no copy values (UNSAT) or yields a new sample.
+// The Skolem functions take the values of the first sample that satisfies psi for D.
+AVR_result Algorithm::expand(unsigned timeout, bool skolem, std::vector<z3::expr>& f) {
+    Trace_Scope scope("Algorithm::expand");
+    int64_t deadline = Tracer::now() + timeout * 1000ll;
+    z3::expr_vector D(ctx), A(ctx), B(ctx), R(ctx);
+    expansion_sets(D, A, B, R);
+    auto assign = [&](const z3::expr_vector& vars, uint64_t bits, z3::expr_vector& dst) {
+        for (unsigned i = 0; i < vars.size(); i++) {
+            dst.push_back(ctx.bool_val((bits >> i) & 1));
+        }
+    };
+
+    z3::expr_vector ys(ctx);
+    size_t n_0 = 1ull << A.size();
+    size_t n_1 = 1ull << B.size();
+    for (size_t a = 0; a < n_0; a++) {
+        ys.push_back(ctx.bool_const((p.var_names[p.e_vars[0]] + "$" + std::to_string(a)).c_str()));
+    }
+    for (size_t b = 0; b < n_1; b++) {
+        ys.push_back(ctx.bool_const((p.var_names[p.e_vars[1]] + "$" + std::to_string(b)).c_str()));
+    }
+    z3::expr_vector src(ctx);
+    for (auto& vars : {A, B, R}) {
+        for (auto v : vars) {
+            src.push_back(v);
+        }
+    }
+    src.push_back(p.var(p.e_vars[0]));
+    src.push_back(p.var(p.e_vars[1]));
+    z3::expr body = p.phi();
+    z3::expr_vector copies(ctx);
+    for (size_t a = 0; a < n_0; a++) {
+        for (size_t b = 0; b < n_1; b++) {
+            for (uint64_t x = 0; x < (1ull << R.size()); x++) {
+                z3::expr_vector dst(ctx);
+                assign(A, a, dst);
+                assign(B, b, dst);
+                assign(R, x, dst);
+                dst.push_back(ys[a]);
+                dst.push_back(ys[n_0 + b]);
+                copies.push_back(body.substitute(src, dst));
+            }
+        }
+    }
+    z3::expr psi = z3::mk_and(copies);
+
+    auto check = [&](z3::solver& solver, const z3::expr_vector& assumptions) {
+        int64_t left = (deadline - Tracer::now()) / 1000;
+        if (left <= 0) {
+            return z3::unknown;
+        }
+        z3::params params(ctx);
+        params.set("timeout", (unsigned)left);
+        solver.set(params);
+        return solver.check(assumptions);
+    };
+    z3::solver expansion(ctx);
+    expansion.add(psi);
+    z3::solver candidates(ctx);
+    std::vector<z3::expr_vector> samples;
+    std::vector<z3::expr> covers;  // psi for the sample, over D
+    while (true) {
+        z3::check_result r = check(candidates, z3::expr_vector(ctx));
+        if (r == z3::unknown) {
+            return AVR_result::UNKNOWN;
+        } else if (r == z3::unsat) {
+            break;
+        }
+        z3::model m = candidates.get_model();
+        z3::expr_vector d(ctx);
+        for (auto v : D) {
+            d.push_back(m.eval(v, true).is_true() ? v : !v);
+        }
+        r = check(expansion, d);
+        if (r == z3::unknown) {
+            return AVR_result::UNKNOWN;
+        } else if (r == z3::unsat) {
+            print_info("UNSAT by universal expansion: some assignment of z0 & z1 has no (y0, y1)");
+            return AVR_result::UNSAT;
+        }
+        z3::model n = expansion.get_model();
+        z3::expr_vector values(ctx);
+        for (auto v : ys) {
+            values.push_back(n.eval(v, true));
+        }
+        samples.push_back(values);
+        covers.push_back(psi.substitute(ys, values).simplify());
+        candidates.add(!covers.back());
+    }
+    print_info(("SAT by universal expansion (" + std::to_string(samples.size()) + " sample(s))").c_str());
+    if (!skolem) {
+        return AVR_result::SAT;
+    }
+
+    // The copies of a sample as a function of A (B): the disjunction of the assignments with value true
+    auto table = [&](const z3::expr_vector& vars, const z3::expr_vector& values, size_t offset, size_t n) {
+        z3::expr_vector cubes(ctx);
+        for (uint64_t a = 0; a < n; a++) {
+            if (values[offset + a].is_true()) {
+                z3::expr_vector lits(ctx);
+                for (unsigned i = 0; i < vars.size(); i++) {
+                    lits.push_back((a >> i) & 1 ? vars[i] : !vars[i]);
+                }
+                cubes.push_back(z3::mk_and(lits));
+            }
+        }
+        return z3::mk_or(cubes);
+    };
+    // Every assignment of D is covered by some sample, so the last one needs no condition
+    f = {table(A, samples.back(), 0, n_0), table(B, samples.back(), n_0, n_1)};
+    for (size_t i = samples.size() - 1; i-- > 0;) {
+        f[0] = z3::ite(covers[i], table(A, samples[i], 0, n_0), f[0]);
+        f[1] = z3::ite(covers[i], table(B, samples[i], n_0, n_1), f[1]);
+    }
+    return AVR_result::SAT;
+}
+
+// Bounded model checking of the transition system with one incremental solver: the transition is unrolled
+// over copies r@0, r@1, ... of the register, starting from the initial state, and each depth is checked
+// for a violation of the property under an assumption. A violation means UNSAT, its path is written to
+// cex_path (if not empty). Returns UNKNOWN when the time limit in ms is reached.
+AVR_result Algorithm::bmc(unsigned timeout, std::string cex_path) {
+    Trace_Scope scope("Algorithm::bmc");
+    int64_t deadline = Tracer::now() + timeout * 1000ll;
+    z3::expr trans = inline_phi(transition);
+    std::vector<z3::expr> regs;
+    auto reg = [&](size_t i) {
+        while (regs.size() <= i) {
+            regs.push_back(ctx.bv_const(("r@" + std::to_string(regs.size())).c_str(), register_size));
+        }
+        return regs[i];
+    };
+
+    z3::solver solver(ctx);
+    solver.add(single_substitute(initial, r, reg(0)));
+    for (size_t depth = 0;; depth++) {
+        int64_t left = (deadline - Tracer::now()) / 1000;
+        if (left <= 0) {
+            print_info(("No counterexample up to depth " + std::to_string(depth) + " by BMC").c_str());
+            return AVR_result::UNKNOWN;
+        }
+        z3::params params(ctx);
+        params.set("timeout", (unsigned)left);
+        solver.set(params);
+
+        z3::expr bad = ctx.bool_const(("bad@" + std::to_string(depth)).c_str());
+        solver.add(z3::implies(bad, !single_substitute(property, r, reg(depth))));
+        z3::check_result result = solver.check(expr2expr_vector(bad));
+        if (result == z3::sat) {
+            print_info(("UNSAT by BMC: counterexample of length " + std::to_string(depth)).c_str());
+            if (cex_path != "") {
+                std::ofstream output(cex_path);
+                if (!output.is_open()) {
+                    print_warning(("Cannot open file " + cex_path + ", the counterexample is not written").c_str());
+                    return AVR_result::UNSAT;
+                }
+                z3::model m = solver.get_model();
+                for (size_t i = 0; i <= depth; i++) {
+                    output << "; step " << i << "\n";
+                    for (size_t j = 0; j < register_size; j++) {
+                        output << slot_names[j] << " = " << m.eval(bv_at(reg(i), j), true).is_true() << "\n";
+                    }
+                }
+                print_info(("Counterexample written to " + cex_path).c_str());
+            }
+            return AVR_result::UNSAT;
+        } else if (result == z3::unknown) {
+            print_info(("No counterexample up to depth " + std::to_string(depth) + " by BMC").c_str());
+            return AVR_result::UNKNOWN;
+        }
+        solver.add(!bad);
+        z3::expr_vector src(ctx);
+        z3::expr_vector dst(ctx);
+        src.push_back(r);
+        src.push_back(r_next);
+        dst.push_back(reg(depth));
+        dst.push_back(reg(depth + 1));
+        solver.add(trans.substitute(src, dst));
+    }
+}
+
+Solve_result Algorithm::run(const Solve_options& options) {
+    Trace_Scope scope("Algorithm::run");
+    auto start = std::chrono::steady_clock::now();
+    Solve_result res;
+    std::string transform = (std::filesystem::path(avr.work_dir) / "transform.smt2").string();
+    std::string inv = (std::filesystem::path(avr.result_dir()) / "inv.smt2").string();
+    // The invariant is kept over the register, only the emitted system depends on the encoding
+    encoding = options.encoding;
+    // Lemmas are loaded before the encoding is known and must hold in its initial states
+    if (!seed_lemmas.empty() && lemmas_encoding != encoding) {
+        print_info(("Lemmas re-filtered for the encoding, " + std::to_string(filter_lemmas()) + " inductive").c_str());
+    }
+    size_t avr_runs = avr.runs;
+    double avr_time = avr.total_time;
+
+    z3::solver solver(p.ctx);
+    z3::expr y_0 = p.var(p.e_vars[0]);
+    z3::expr y_1 = p.var(p.e_vars[1]);
+    auto skolem_check = [&](z3::expr& f_0, z3::expr& f_1) {
+        Trace_Scope scope("Skolem check");
+        return solver.check(expr2expr_vector((y_0 == f_0) && (y_1 == f_1)));
+    };
+
+    // Re-validate the result of the previous run before calling AVR
+    AVR_result result = AVR_result::UNKNOWN;
+    std::optional<z3::expr> S;
+    bool phi_asserted = false;
+    if (options.skolem && !last_skolem.empty()) {
+        solver.add(!p.phi());
+        phi_asserted = true;
+        if (skolem_check(last_skolem[0], last_skolem[1]) == z3::unsat) {
+            print_info("Previous Skolem functions are still valid");
+            result = AVR_result::SAT;
+            res.stats.reused = true;
+        }
+    }
+    if (result == AVR_result::UNKNOWN && last_S && S_still_inductive(*last_S)) {
+        print_info("Previous invariant is still inductive");
+        result = AVR_result::SAT;
+        res.stats.reused = true;
+        S = last_S;
+    }
+    if (result == AVR_result::UNKNOWN && options.filter_timeout > 0) {
+        std::vector<z3::expr> f;
+        result = qbf_filters(options.filter_timeout, options.skolem, f);
+        if (result == AVR_result::SAT && options.skolem) {
+            if (!phi_asserted) {
+                solver.add(!p.phi());
+                phi_asserted = true;
+            }
+            if (skolem_check(f[0], f[1]) != z3::unsat) {
+                throw DQBF_error("Skolem functions from the QBF filter do not satisfy phi");
+            }
+            last_skolem = {f[0].simplify(), f[1].simplify()};
+        }
+        res.stats.filtered = result != AVR_result::UNKNOWN;
+    }
+    if (result == AVR_result::UNKNOWN && options.expansion_budget > 0 && expansion_size() <= options.expansion_budget) {
+        std::vector<z3::expr> f;
+        result = expand(options.expansion_timeout, options.skolem, f);
+        if (result == AVR_result::SAT && options.skolem) {
+            if (!phi_asserted) {
+                solver.add(!p.phi());
+                phi_asserted = true;
+            }
+            if (skolem_check(f[0], f[1]) != z3::unsat) {
+                throw DQBF_error("Skolem functions from the universal expansion do not satisfy phi");
+            }
+            last_skolem = {f[0].simplify(), f[1].simplify()};
+        }
+        res.stats.expanded = result != AVR_result::UNKNOWN;
+    }
+    if (result == AVR_result::UNKNOWN && options.bmc_timeout > 0) {
+        std::string cex = options.output_dir != "" ? (std::filesystem::path(options.output_dir) / "counterexample.txt").string() : "";
+        result = bmc(options.bmc_timeout, cex);
+        res.stats.bmc = result != AVR_result::UNKNOWN;
+    }
+    // The transition relation of a resumed run is patched, so BMC and AVR do not decide the instance
+    bool on_patched_system = resumed && result == AVR_result::UNKNOWN;
+    if (res.stats.bmc && resumed) {
+        throw DQBF_error("BMC found a counterexample on the patched transition system");
+    }
+    if (result == AVR_result::UNKNOWN) {
+        print_info("Solving");
+        print_to_file(transform);
+        avr.start(transform);
+        // Prepare the Skolem check while AVR is running
+        if (options.skolem && !phi_asserted) {
+            solver.add(!p.phi());
+            phi_asserted = true;
+        }
+        result = avr.wait();
+        if (on_patched_system && result != AVR_result::SAT) {
+            throw DQBF_error("AVR did not return SAT on the patched transition system");
+        }
+        resumed = false;
+    } else if (options.skolem && !phi_asserted) {
+        solver.add(!p.phi());
+    }
+
+    if (result == AVR_result::UNKNOWN) {
+        throw DQBF_error("AVR returned an unknown result");
+    }
     if (result == AVR_result::TIMEOUT) {
         print_info("Timeout");
     } else if (result == AVR_result::UNSAT) {
         print_info("UNSAT");
     } else if (result == AVR_result::SAT) {
         print_info("SAT");
-        if (gen_skolem) {
+        if (!S && !res.stats.reused && !res.stats.filtered && !res.stats.expanded) {
+            S = extract_S(inv);
+        }
+        if (options.skolem && S) {
             print_info("Extracting Skolem function");
-            z3::expr y_0 = p.e_vars[0].first;
-            z3::expr y_1 = p.e_vars[1].first;
-            z3::expr S = extract_S("./output/work_test/inv.smt2");
-            z3::expr f_0 = skolem_from_S(S, 0);
-            z3::expr f_1 = skolem_from_S(S, 1);
-            z3::solver solver(p.ctx);
-            solver.add(!p.phi);
-
-            while (solver.check(expr2expr_vector((y_0 == f_0) && (y_1 == f_1))) == z3::sat) {
+            z3::expr f_0 = skolem_from_S(*S, 0);
+            z3::expr f_1 = skolem_from_S(*S, 1);
+
+            // The patches and the last invariant are saved before every AVR run, for resume()
+            std::string checkpoint = options.output_dir != "" ? (std::filesystem::path(options.output_dir) / "checkpoint.smt2").string() : "";
+            while (skolem_check(f_0, f_1) == z3::sat) {
                 z3::model counterexample = solver.get_model();
-                patch(counterexample);
-                print_to_file("./transform.smt2");
-                result = avr.run_avr("./transform.smt2");
-                assert(result == AVR_result::SAT);
-                S = extract_S("./output/work_test/inv.smt2");
-                f_0 = skolem_from_S(S, 0);
-                f_1 = skolem_from_S(S, 1);
+                patch(generalise(cube_from_model(counterexample), f_0, f_1));
+                res.stats.patches++;
+                iteration++;
+                if (checkpoint != "") {
+                    save_checkpoint(*S, checkpoint);
+                }
+                print_to_file(transform);
+                result = avr.run_avr(transform);
+                if (result != AVR_result::SAT) {
+                    throw DQBF_error("AVR did not return SAT on the patched transition system");
+                }
+                S = extract_S(inv);
+                f_0 = skolem_from_S(*S, 0);
+                f_1 = skolem_from_S(*S, 1);
+            }
+            if (checkpoint != "") {
+                std::filesystem::remove(checkpoint);
+            }
+            if (options.minimise) {
+                // Spend at most a quarter of the time taken so far (at least a second)
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                minimise_skolem(f_0, f_1, solver, std::max<unsigned>(1000, elapsed / 4));
             }
             dependencies_check(f_0, f_1);
-            save_proof(f_0, f_1, "./proof.smt2");
+            last_skolem = {f_0.simplify(), f_1.simplify()};
+        }
+        if (options.skolem) {
+            if (options.output_dir != "") {
+                save_proof(p, last_skolem[0], last_skolem[1], (std::filesystem::path(options.output_dir) / "proof.smt2").string());
+            }
+            res.skolem = last_skolem;
+        }
+        if (S) {
+            last_S = S;
+            if (options.save_lemmas != "") {
+                save_lemmas(*S, options.save_lemmas);
+            }
         }
     }
-}
\ No newline at end of file
+    if (result != AVR_result::SAT) {
+        last_S.reset();
+        last_skolem.clear();
+    }
+    res.verdict = result;
+    res.stats.avr_runs = avr.runs - avr_runs;
+    res.stats.avr_time = avr.total_time - avr_time;
+    return res;
+}
@@ -1,33 +1,315 @@
 #include "avr_wrapper.hpp"
 
+#include <signal.h>
+
 #include <boost/process.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <optional>
+#include <regex>
+#include <sstream>
 
+#include "trace.hpp"
 #include "utils.hpp"
 
 AVR_Wrapper::AVR_Wrapper(std::string bin_path) {
     this->bin_path = bin_path;
     if (!std::filesystem::exists(std::filesystem::path(bin_path.c_str()) / "avr")) {
-        print_error("avr not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
+        throw DQBF_error("avr not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
     }
     if (!std::filesystem::exists(std::filesystem::path(bin_path.c_str()) / "bin/dpa")) {
-        print_error("bin/dpa not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
+        throw DQBF_error("bin/dpa not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
     }
     if (!std::filesystem::exists(std::filesystem::path(bin_path.c_str()) / "bin/reach")) {
-        print_error("bin/reach not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
+        throw DQBF_error("bin/reach not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
     }
     if (!std::filesystem::exists(std::filesystem::path(bin_path.c_str()) / "bin/vwn")) {
-        print_error("bin/vwn not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
+        throw DQBF_error("bin/vwn not found\nPlease make sure that the path to the avr binary is correct with --avr_bin <path> (Default: ../avr/build)");
+    }
+}
+
+// Record the processes of the AVR process group (avr, vwn, reach, dpa) from /proc, each with the
+// times it was first and last seen. Called every 100 ms by the watchdog, so shorter processes may be
+// missed. Linux only, elsewhere no processes are found.
+void AVR_Wrapper::sample_children(int64_t now) {
+    std::error_code ec;
+    for (auto& entry : std::filesystem::directory_iterator("/proc", ec)) {
+        std::string name = entry.path().filename().string();
+        if (!std::all_of(name.begin(), name.end(), ::isdigit)) {
+            continue;
+        }
+        // "<pid> (<comm>) <state> <ppid> <pgrp> ...", comm may contain spaces and parentheses
+        std::ifstream stat(entry.path() / "stat");
+        std::string line;
+        if (!getline(stat, line)) {
+            continue;
+        }
+        size_t open = line.find('('), close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos || close < open) {
+            continue;
+        }
+        std::istringstream rest(line.substr(close + 1));
+        std::string state;
+        pid_t ppid, pgrp;
+        if (!(rest >> state >> ppid >> pgrp) || pgrp != pgid) {
+            continue;
+        }
+        pid_t pid = std::stoi(name);
+        auto it = children.find(pid);
+        if (it == children.end()) {
+            children[pid] = {line.substr(open + 1, close - open - 1), now, now};
+        } else {
+            it->second.last = now;
+        }
+    }
+}
+
+// One span for the whole run and one per process of the group, a row per process
+void AVR_Wrapper::trace_children(int pid, int64_t end) {
+    Tracer::name_process(pid, "avr (pid " + std::to_string(pid) + ")");
+    Tracer::add_span("avr", "avr", start_time, end - start_time, pid, 0);
+    int row = 1;
+    for (auto& [child, c] : children) {
+        Tracer::add_span(c.name + " (pid " + std::to_string(child) + ")", "avr", c.first, c.last - c.first, pid, row++);
+    }
+}
+
+std::atomic<int> AVR_Wrapper::pending_signal(0);
+std::atomic<pid_t> AVR_Wrapper::child_groups[AVR_Wrapper::max_children];
+
+// The slots are lock-free atomics, so that the signal handler can read them
+void AVR_Wrapper::register_group(pid_t pgid) {
+    for (auto& slot : child_groups) {
+        pid_t empty = 0;
+        if (slot.compare_exchange_strong(empty, pgid)) {
+            return;
+        }
+    }
+    print_warning("Too many concurrent AVR runs, signals reach the extra ones through their watchdog only");
+}
+
+void AVR_Wrapper::unregister_group(pid_t pgid) {
+    for (auto& slot : child_groups) {
+        pid_t expected = pgid;
+        if (slot.compare_exchange_strong(expected, 0)) {
+            return;
+        }
     }
 }
 
+void AVR_Wrapper::on_signal(int sig) {
+    bool forwarded = false;
+    for (auto& slot : child_groups) {
+        pid_t pgid = slot.load();
+        if (pgid != 0) {
+            ::kill(-pgid, sig);
+            forwarded = true;
+        }
+    }
+    if (!forwarded) {
+        // Nothing to forward to, default action
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+    pending_signal = sig;
+}
+
+void AVR_Wrapper::forward_signals() {
+    signal(SIGINT, AVR_Wrapper::on_signal);
+    signal(SIGTERM, AVR_Wrapper::on_signal);
+    signal(SIGHUP, AVR_Wrapper::on_signal);
+}
+
+std::string AVR_Wrapper::result_dir() {
+    return (std::filesystem::path(work_dir) / "output/work_test").string();
+}
+
 AVR_result AVR_Wrapper::run_avr(std::string input) {
-    std::string command = (std::filesystem::path(bin_path.c_str()) / "avr").string() + " " + input + " - . test output " + (std::filesystem::path(bin_path.c_str()) / "bin").string() + " yosys clk 3600 64000 False True 2 False 0 \"-\" 0 - True sa+uf False 0 0 2 0 - True True 0000000 False False False 1000 True";
-    // boost::process::system("timeout 600 python3 ./avr.py -b " + bin_path + " --smt2 --witness --aig " + input);
+    start(input);
+    return wait();
+}
+
+void AVR_Wrapper::start(std::string input) {
+    std::vector<std::string> args = {std::filesystem::absolute(input).string(), "-", ".", "test", "output", (std::filesystem::path(bin_path.c_str()) / "bin").string(), "yosys", "clk", "3600", "64000", "False", "True", "2", "False", "0", "-", "0", "-", "True", "sa+uf", "False", "0", "0", "2", "0", "-", "True", "True", "0000000", "False", "False", "False", "1000", "True"};
+    for (auto& [key, value] : options) {
+        size_t idx;
+        if (key == "timeout") {
+            idx = 8;
+        } else if (key == "memout") {
+            idx = 9;
+        } else if (key == "abstraction") {
+            idx = 19;
+        } else if (key.rfind("arg", 0) == 0 && key.size() > 3 && std::all_of(key.begin() + 3, key.end(), ::isdigit)) {
+            idx = std::stoul(key.substr(3));
+        } else {
+            throw DQBF_error("Unknown AVR option " + key);
+        }
+        if (idx == 0 || idx >= args.size()) {
+            throw DQBF_error("AVR option " + key + " is out of range");
+        }
+        args[idx] = value;
+    }
     print_info("Running AVR");
-    boost::process::system("timeout 600 " + command);
-    std::ifstream result("./output/work_test/result.pr");
+
+    // Do not pick up the verdict of a previous run if this one is killed
+    std::filesystem::remove(std::filesystem::path(result_dir()) / "result.pr");
+
+    progress = AVR_progress();
+    cancelled = false;
+    stop_reason = "";
+    children.clear();
+    start_time = Tracer::now();
+    last_output = start_time;
+
+    // AVR runs in its own process group so that vwn/reach are killed along with it
+    out = std::make_unique<boost::process::ipstream>();
+    err = std::make_unique<boost::process::ipstream>();
+    group = std::make_unique<boost::process::group>();
+    proc = std::make_unique<boost::process::child>(boost::process::exe = (std::filesystem::path(bin_path.c_str()) / "avr").string(), boost::process::args = args, boost::process::std_out > *out, boost::process::std_err > *err, boost::process::start_dir = work_dir, *group);
+    pgid = group->native_handle();
+    register_group(pgid);
+
+    readers.emplace_back(&AVR_Wrapper::read_output, this, std::ref(*out), Log_level::AVR_STDOUT);
+    readers.emplace_back(&AVR_Wrapper::read_output, this, std::ref(*err), Log_level::AVR_STDERR);
+    watchdog = std::thread(&AVR_Wrapper::watch, this);
+}
+
+void AVR_Wrapper::read_output(boost::process::ipstream& in, Log_level level) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (log) {
+            log(level, line);
+        }
+        parse_progress(line);
+    }
+}
+
+// Value of a regex group, nullopt if it does not fit into an int (AVR output is not trusted)
+static std::optional<int> parse_int(const std::ssub_match& m) {
+    int v;
+    auto [ptr, ec] = std::from_chars(&*m.first, &*m.first + m.length(), v);
+    if (ec != std::errc()) {
+        return std::nullopt;
+    }
+    return v;
+}
+
+void AVR_Wrapper::parse_progress(const std::string& line) {
+    static const std::regex frame_re("frame[^0-9]*([0-9]+)", std::regex::icase);
+    static const std::regex lemma_re("(lemma|clause)s?[^0-9]*([0-9]+)", std::regex::icase);
+    static const std::regex bound_re("(bound|depth)[^0-9]*([0-9]+)", std::regex::icase);
+    std::smatch m;
+    AVR_progress snapshot;
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::optional<int> v;
+        if (std::regex_search(line, m, frame_re) && (v = parse_int(m[1])) && *v != progress.frame) {
+            progress.frame = *v;
+            changed = true;
+        }
+        if (std::regex_search(line, m, lemma_re) && (v = parse_int(m[2])) && *v != progress.lemmas) {
+            progress.lemmas = *v;
+            changed = true;
+        }
+        if (std::regex_search(line, m, bound_re) && (v = parse_int(m[2])) && *v != progress.bound) {
+            progress.bound = *v;
+            changed = true;
+        }
+        progress.line = line;
+        progress.elapsed = (Tracer::now() - start_time) / 1e6;
+        // Any output line counts against the stall timeout: the frame/lemma/bound patterns are guesses
+        // at AVR's wording and may never match
+        last_output = Tracer::now();
+        snapshot = progress;
+    }
+    if (changed && on_progress) {
+        std::lock_guard<std::mutex> lock(callback_mtx);
+        on_progress(snapshot);
+    }
+}
+
+// Waits for AVR, enforces the timeouts, forwards signals and sends heartbeats
+void AVR_Wrapper::watch() {
+    int64_t last_heartbeat = start_time;
+    while (!proc->wait_for(std::chrono::milliseconds(100))) {
+        int64_t now = Tracer::now();
+        std::string reason;
+        if (pending_signal) {
+            // Already forwarded by on_signal unless this group has no slot
+            ::kill(-pgid, pending_signal);
+            reason = "interrupted";
+        } else if (cancelled) {
+            reason = "cancelled";
+        } else if (now - start_time > timeout * 1000000ll) {
+            reason = "timeout";
+        } else if (stall_timeout > 0 && now - last_output > stall_timeout * 1000000ll) {
+            reason = "stalled";
+        }
+        if (reason != "") {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop_reason = reason;
+            }
+            if (reason != "interrupted") {
+                group->terminate();
+            }
+            proc->wait();
+            break;
+        }
+        if (Tracer::enabled()) {
+            sample_children(now);
+        }
+        if (on_progress && now - last_heartbeat >= 1000000) {
+            last_heartbeat = now;
+            AVR_progress snapshot = get_progress();
+            std::lock_guard<std::mutex> lock(callback_mtx);
+            on_progress(snapshot);
+        }
+    }
+    unregister_group(pgid);
+}
+
+void AVR_Wrapper::cancel() {
+    cancelled = true;
+}
+
+AVR_progress AVR_Wrapper::get_progress() {
+    std::lock_guard<std::mutex> lock(mtx);
+    progress.elapsed = (Tracer::now() - start_time) / 1e6;
+    return progress;
+}
+
+AVR_result AVR_Wrapper::wait() {
+    Trace_Scope scope("AVR_Wrapper::wait");
+    watchdog.join();
+    for (auto& t : readers) {
+        t.join();
+    }
+    readers.clear();
+    int64_t end = Tracer::now();
+    int pid = proc->id();
+    proc.reset();
+    group.reset();
+    if (Tracer::enabled()) {
+        trace_children(pid, end);
+    }
+    runs++;
+    total_time += (end - start_time) / 1e6;
+    print_info(("AVR time: " + std::to_string((end - start_time) / 1e6) + " s").c_str());
+
+    if (pending_signal) {
+        throw AVR_interrupted(pending_signal);
+    }
+    if (stop_reason != "") {
+        print_info(("AVR " + stop_reason).c_str());
+        return AVR_result::TIMEOUT;
+    }
+
+    std::ifstream result(std::filesystem::path(result_dir()) / "result.pr");
     std::string line = "";
     getline(result, line);
     if (line == "") {
@@ -42,4 +324,4 @@ AVR_result AVR_Wrapper::run_avr(std::string input) {
     }
     print_info("AVR UNKNOWN");
     return AVR_result::UNKNOWN;
-}
\ No newline at end of file
+}
@@ -0,0 +1,510 @@
+#include "circuit.hpp"
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <functional>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+
+Circuit::Circuit() {
+    kind.push_back(Kind::CONST);
+    fanin_begin = {0, 0};
+    input_index.push_back(0);
+}
+
+Circuit::lit Circuit::add_input() {
+    uint32_t n = kind.size();
+    kind.push_back(Kind::INPUT);
+    fanin_begin.push_back(fanins.size());
+    input_index.push_back(input_nodes.size());
+    input_nodes.push_back(n);
+    return mk_lit(n);
+}
+
+Circuit::lit Circuit::add_gate(Kind k, const std::vector<lit>& fanin) {
+    size_t h = boost::hash_range(fanin.begin(), fanin.end());
+    boost::hash_combine(h, k);
+    auto range = strash.equal_range(h);
+    for (auto it = range.first; it != range.second; it++) {
+        uint32_t n = it->second;
+        if (kind[n] == k && num_fanins(n) == fanin.size() && std::equal(fanin.begin(), fanin.end(), fanins.begin() + fanin_begin[n])) {
+            return mk_lit(n);
+        }
+    }
+    uint32_t n = kind.size();
+    kind.push_back(k);
+    fanins.insert(fanins.end(), fanin.begin(), fanin.end());
+    fanin_begin.push_back(fanins.size());
+    input_index.push_back(0);
+    strash.emplace(h, n);
+    return mk_lit(n);
+}
+
+Circuit::lit Circuit::mk_and(std::vector<lit> fanin) {
+    std::sort(fanin.begin(), fanin.end());
+    fanin.erase(std::unique(fanin.begin(), fanin.end()), fanin.end());
+    std::vector<lit> res;
+    for (auto l : fanin) {
+        if (l == FALSE) {
+            return FALSE;
+        } else if (l == TRUE) {
+            continue;
+        } else if (!res.empty() && res.back() == (l ^ 1)) {
+            return FALSE;  // x & !x
+        }
+        res.push_back(l);
+    }
+    if (res.empty()) {
+        return TRUE;
+    } else if (res.size() == 1) {
+        return res[0];
+    }
+    return add_gate(Kind::AND, res);
+}
+
+Circuit::lit Circuit::mk_or(std::vector<lit> fanin) {
+    for (auto& l : fanin) {
+        l ^= 1;
+    }
+    return mk_and(fanin) ^ 1;
+}
+
+Circuit::lit Circuit::mk_xor(lit a, lit b) {
+    bool neg = is_neg(a) ^ is_neg(b);
+    a &= ~1u;
+    b &= ~1u;
+    if (a > b) {
+        std::swap(a, b);
+    }
+    if (a == FALSE) {
+        return b ^ neg;
+    } else if (a == b) {
+        return FALSE ^ neg;
+    }
+    return add_gate(Kind::XOR, {a, b}) ^ neg;
+}
+
+std::vector<bool> Circuit::cone(lit root) const {
+    std::vector<bool> in_cone(node(root) + 1, false);
+    in_cone[node(root)] = true;
+    for (int64_t n = node(root); n >= 0; n--) {
+        if (in_cone[n]) {
+            for (size_t i = 0; i < num_fanins(n); i++) {
+                in_cone[node(fanin(n, i))] = true;
+            }
+        }
+    }
+    return in_cone;
+}
+
+size_t Circuit::cone_size(lit root) const {
+    std::vector<bool> in_cone = cone(root);
+    size_t cnt = 0;
+    for (size_t n = 0; n < in_cone.size(); n++) {
+        if (in_cone[n] && (kind[n] == Kind::AND || kind[n] == Kind::XOR)) {
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+std::vector<uint32_t> Circuit::support(lit root) const {
+    std::vector<bool> in_cone = cone(root);
+    std::vector<uint32_t> inputs;
+    for (size_t n = 0; n < in_cone.size(); n++) {
+        if (in_cone[n] && kind[n] == Kind::INPUT) {
+            inputs.push_back(input_index[n]);
+        }
+    }
+    return inputs;
+}
+
+std::vector<uint64_t> Circuit::simulate(const std::vector<uint64_t>& input_words) const {
+    std::vector<uint64_t> words(num_nodes(), 0);
+    for (size_t n = 1; n < num_nodes(); n++) {
+        if (kind[n] == Kind::INPUT) {
+            words[n] = input_words[input_index[n]];
+        } else if (kind[n] == Kind::AND) {
+            uint64_t w = ~0ull;
+            for (size_t i = 0; i < num_fanins(n); i++) {
+                w &= value(words, fanin(n, i));
+            }
+            words[n] = w;
+        } else if (kind[n] == Kind::XOR) {
+            words[n] = value(words, fanin(n, 0)) ^ value(words, fanin(n, 1));
+        }
+    }
+    return words;
+}
+
+z3::expr Circuit::to_expr(z3::context& ctx, lit root, const std::vector<z3::expr>& inputs) const {
+    // Both polarities are built on demand, a complemented AND becomes an OR of complemented fanins
+    std::vector<std::optional<z3::expr>> memo(2 * (node(root) + 1));
+    auto children = [&](lit l) {
+        std::vector<lit> res;
+        uint32_t n = node(l);
+        if (kind[n] == Kind::AND) {
+            for (size_t i = 0; i < num_fanins(n); i++) {
+                res.push_back(fanin(n, i) ^ (is_neg(l) ? 1 : 0));
+            }
+        } else if (kind[n] == Kind::XOR) {
+            if (is_neg(l)) {
+                res.push_back(l ^ 1);
+            } else {
+                res.push_back(fanin(n, 0));
+                res.push_back(fanin(n, 1));
+            }
+        }
+        return res;
+    };
+
+    std::vector<std::pair<lit, bool>> stack = {{root, false}};
+    while (!stack.empty()) {
+        auto [l, expanded] = stack.back();
+        if (memo[l]) {
+            stack.pop_back();
+            continue;
+        }
+        std::vector<lit> ch = children(l);
+        if (!expanded) {
+            stack.back().second = true;
+            for (auto c : ch) {
+                if (!memo[c]) {
+                    stack.emplace_back(c, false);
+                }
+            }
+            continue;
+        }
+        stack.pop_back();
+        uint32_t n = node(l);
+        if (kind[n] == Kind::CONST) {
+            memo[l] = ctx.bool_val(is_neg(l));
+        } else if (kind[n] == Kind::INPUT) {
+            memo[l] = is_neg(l) ? !inputs[input_index[n]] : inputs[input_index[n]];
+        } else if (kind[n] == Kind::AND) {
+            z3::expr_vector args(ctx);
+            for (auto c : ch) {
+                args.push_back(*memo[c]);
+            }
+            memo[l] = is_neg(l) ? z3::mk_or(args) : z3::mk_and(args);
+        } else if (is_neg(l)) {
+            memo[l] = !*memo[l ^ 1];
+        } else {
+            memo[l] = *memo[ch[0]] ^ *memo[ch[1]];
+        }
+    }
+    return *memo[root];
+}
+
+Circuit::lit Circuit::add_expr(const z3::expr& e, const std::unordered_map<unsigned, lit>& inputs) {
+    std::unordered_map<unsigned, lit> memo;
+    // Bitvector terms are bit-blasted, bits of each term LSB first
+    std::unordered_map<unsigned, std::vector<lit>> words;
+    auto done = [&](const z3::expr& t) {
+        return memo.count(t.id()) || words.count(t.id());
+    };
+    std::vector<std::pair<z3::expr, bool>> stack = {{e, false}};
+    while (!stack.empty()) {
+        auto [t, expanded] = stack.back();
+        if (done(t)) {
+            stack.pop_back();
+            continue;
+        }
+        if (t.is_true() || t.is_false()) {
+            memo[t.id()] = t.is_true() ? TRUE : FALSE;
+            stack.pop_back();
+            continue;
+        }
+        if (t.is_bv() && t.is_numeral()) {
+            std::string s;
+            t.as_binary(s);
+            std::vector<lit> bits(t.get_sort().bv_size(), FALSE);
+            for (size_t i = 0; i < s.size() && i < bits.size(); i++) {
+                bits[i] = s[s.size() - 1 - i] == '1' ? TRUE : FALSE;
+            }
+            words[t.id()] = bits;
+            stack.pop_back();
+            continue;
+        }
+        if (t.is_const()) {
+            auto it = inputs.find(t.id());
+            if (it == inputs.end()) {
+                throw std::invalid_argument("Unknown constant " + t.to_string());
+            }
+            memo[t.id()] = it->second;
+            stack.pop_back();
+            continue;
+        }
+        if (!expanded) {
+            stack.back().second = true;
+            for (unsigned i = 0; i < t.num_args(); i++) {
+                if (!done(t.arg(i))) {
+                    stack.emplace_back(t.arg(i), false);
+                }
+            }
+            continue;
+        }
+        stack.pop_back();
+        if (t.is_bv() || (t.num_args() > 0 && t.arg(0).is_bv())) {
+            add_bv_term(t, memo, words);
+            continue;
+        }
+        std::vector<lit> args;
+        for (unsigned i = 0; i < t.num_args(); i++) {
+            if (!t.arg(i).is_bool()) {
+                throw std::invalid_argument("Non-Boolean argument in " + t.decl().name().str());
+            }
+            args.push_back(memo[t.arg(i).id()]);
+        }
+        switch (t.decl().decl_kind()) {
+            case Z3_OP_AND:
+                memo[t.id()] = mk_and(args);
+                break;
+            case Z3_OP_OR:
+                memo[t.id()] = mk_or(args);
+                break;
+            case Z3_OP_NOT:
+                memo[t.id()] = args[0] ^ 1;
+                break;
+            case Z3_OP_XOR:
+            case Z3_OP_DISTINCT:
+                if (args.size() != 2) {
+                    throw std::invalid_argument("Unsupported operator " + t.decl().name().str());
+                }
+                memo[t.id()] = mk_xor(args[0], args[1]);
+                break;
+            case Z3_OP_EQ:
+            case Z3_OP_IFF:
+                memo[t.id()] = mk_xor(args[0], args[1]) ^ 1;
+                break;
+            case Z3_OP_IMPLIES:
+                memo[t.id()] = mk_or({args[0] ^ 1, args[1]});
+                break;
+            case Z3_OP_ITE:
+                memo[t.id()] = mk_or({mk_and({args[0], args[1]}), mk_and({args[0] ^ 1, args[2]})});
+                break;
+            default:
+                throw std::invalid_argument("Unsupported operator " + t.decl().name().str());
+        }
+    }
+    return memo[e.id()];
+}
+
+void Circuit::add_bv_term(const z3::expr& t, std::unordered_map<unsigned, lit>& memo,
+                          std::unordered_map<unsigned, std::vector<lit>>& words) {
+    auto bits = [&](unsigned i) -> const std::vector<lit>& {
+        auto it = words.find(t.arg(i).id());
+        if (it == words.end()) {
+            throw std::invalid_argument("Non-bitvector argument in " + t.decl().name().str());
+        }
+        return it->second;
+    };
+    auto bitwise = [&](auto op) {
+        std::vector<lit> r = bits(0);
+        for (unsigned i = 1; i < t.num_args(); i++) {
+            for (size_t j = 0; j < r.size(); j++) {
+                r[j] = op(r[j], bits(i)[j]);
+            }
+        }
+        return r;
+    };
+    // a < b (or a <= b if le), scanning from the LSB
+    auto less = [&](const std::vector<lit>& a, const std::vector<lit>& b, bool le) {
+        lit r = le ? TRUE : FALSE;
+        for (size_t j = 0; j < a.size(); j++) {
+            r = mk_or({mk_and({a[j] ^ 1, b[j]}), mk_and({mk_xor(a[j], b[j]) ^ 1, r})});
+        }
+        return r;
+    };
+    switch (t.decl().decl_kind()) {
+        case Z3_OP_CONCAT: {
+            std::vector<lit> r;
+            for (unsigned i = t.num_args(); i-- > 0;) {
+                r.insert(r.end(), bits(i).begin(), bits(i).end());
+            }
+            words[t.id()] = r;
+            break;
+        }
+        case Z3_OP_EXTRACT:
+            words[t.id()] = std::vector<lit>(bits(0).begin() + t.lo(), bits(0).begin() + t.hi() + 1);
+            break;
+        case Z3_OP_ITE: {
+            lit c = memo.at(t.arg(0).id());
+            std::vector<lit> r;
+            for (size_t j = 0; j < bits(1).size(); j++) {
+                r.push_back(mk_or({mk_and({c, bits(1)[j]}), mk_and({c ^ 1, bits(2)[j]})}));
+            }
+            words[t.id()] = r;
+            break;
+        }
+        case Z3_OP_BNOT: {
+            std::vector<lit> r = bits(0);
+            for (auto& l : r) {
+                l ^= 1;
+            }
+            words[t.id()] = r;
+            break;
+        }
+        case Z3_OP_BAND:
+            words[t.id()] = bitwise([&](lit a, lit b) { return mk_and({a, b}); });
+            break;
+        case Z3_OP_BOR:
+            words[t.id()] = bitwise([&](lit a, lit b) { return mk_or({a, b}); });
+            break;
+        case Z3_OP_BXOR:
+            words[t.id()] = bitwise([&](lit a, lit b) { return mk_xor(a, b); });
+            break;
+        case Z3_OP_EQ:
+        case Z3_OP_DISTINCT: {
+            if (t.num_args() != 2) {
+                throw std::invalid_argument("Unsupported operator " + t.decl().name().str());
+            }
+            std::vector<lit> eq;
+            for (size_t j = 0; j < bits(0).size(); j++) {
+                eq.push_back(mk_xor(bits(0)[j], bits(1)[j]) ^ 1);
+            }
+            memo[t.id()] = mk_and(eq) ^ (t.decl().decl_kind() == Z3_OP_DISTINCT ? 1 : 0);
+            break;
+        }
+        case Z3_OP_ULEQ:
+            memo[t.id()] = less(bits(0), bits(1), true);
+            break;
+        case Z3_OP_ULT:
+            memo[t.id()] = less(bits(0), bits(1), false);
+            break;
+        case Z3_OP_UGEQ:
+            memo[t.id()] = less(bits(1), bits(0), true);
+            break;
+        case Z3_OP_UGT:
+            memo[t.id()] = less(bits(1), bits(0), false);
+            break;
+        default:
+            throw std::invalid_argument("Unsupported operator " + t.decl().name().str());
+    }
+}
+
+Circuit::lit Circuit::add_cone(const Circuit& src, lit root, std::unordered_map<uint32_t, lit>& map) {
+    std::vector<bool> in_cone = src.cone(root);
+    map[0] = FALSE;
+    for (uint32_t n = 0; n < in_cone.size(); n++) {
+        if (!in_cone[n] || map.count(n)) {
+            continue;
+        }
+        if (src.kind[n] == Kind::INPUT) {
+            throw std::invalid_argument("Unmapped input " + std::to_string(src.input_index[n]));
+        }
+        std::vector<lit> fanin;
+        for (size_t i = 0; i < src.num_fanins(n); i++) {
+            fanin.push_back(map[node(src.fanin(n, i))] ^ (is_neg(src.fanin(n, i)) ? 1 : 0));
+        }
+        map[n] = src.kind[n] == Kind::AND ? mk_and(fanin) : mk_xor(fanin[0], fanin[1]);
+    }
+    return map[node(root)] ^ (is_neg(root) ? 1 : 0);
+}
+
+Circuit Circuit::fraig(std::vector<lit>& roots, z3::context& ctx, unsigned timeout_ms) const {
+    // Signatures from 4 x 64 random patterns, the class key is the signature with bit 0 cleared
+    const int rounds = 4;
+    std::mt19937_64 rng(1);
+    std::vector<std::vector<uint64_t>> sig(num_nodes());
+    for (int k = 0; k < rounds; k++) {
+        std::vector<uint64_t> input_words(num_inputs());
+        for (auto& w : input_words) {
+            w = rng();
+        }
+        std::vector<uint64_t> words = simulate(input_words);
+        for (size_t n = 0; n < num_nodes(); n++) {
+            sig[n].push_back(words[n]);
+        }
+    }
+    auto phase = [&](uint32_t n) { return (sig[n][0] & 1) != 0; };
+    auto canonical = [&](uint32_t n) {
+        std::vector<uint64_t> s = sig[n];
+        if (phase(n)) {
+            for (auto& w : s) {
+                w = ~w;
+            }
+        }
+        return s;
+    };
+
+    std::vector<bool> in_cone(num_nodes(), false);
+    for (auto root : roots) {
+        std::vector<bool> c = cone(root);
+        for (size_t n = 0; n < c.size(); n++) {
+            in_cone[n] = in_cone[n] || c[n];
+        }
+    }
+
+    Circuit res;
+    std::vector<lit> repr(num_nodes(), FALSE);
+    for (size_t i = 0; i < num_inputs(); i++) {
+        repr[input_nodes[i]] = res.add_input();
+    }
+
+    // z3 encoding of the nodes of res, one variable per node
+    z3::solver solver(ctx);
+    z3::params params(ctx);
+    params.set("timeout", timeout_ms);
+    solver.set(params);
+    std::vector<std::optional<z3::expr>> vars;
+    std::function<z3::expr(lit)> var = [&](lit l) -> z3::expr {
+        uint32_t n = node(l);
+        if (vars.size() <= n) {
+            vars.resize(n + 1);
+        }
+        if (!vars[n]) {
+            vars[n] = ctx.bool_const(("fraig!" + std::to_string(n)).c_str());
+            if (res.kind[n] == Kind::CONST) {
+                solver.add(!*vars[n]);
+            } else if (res.kind[n] == Kind::AND) {
+                z3::expr_vector args(ctx);
+                for (size_t i = 0; i < res.num_fanins(n); i++) {
+                    args.push_back(var(res.fanin(n, i)));
+                }
+                solver.add(*vars[n] == z3::mk_and(args));
+            } else if (res.kind[n] == Kind::XOR) {
+                solver.add(*vars[n] == (var(res.fanin(n, 0)) ^ var(res.fanin(n, 1))));
+            }
+        }
+        return is_neg(l) ? !*vars[n] : *vars[n];
+    };
+
+    // Representative (in the canonical phase) of each signature class
+    std::map<std::vector<uint64_t>, lit> classes;
+    for (size_t n = 0; n < num_nodes(); n++) {
+        if (!in_cone[n]) {
+            continue;
+        }
+        if (kind[n] == Kind::AND || kind[n] == Kind::XOR) {
+            std::vector<lit> new_fanin;
+            for (size_t i = 0; i < num_fanins(n); i++) {
+                new_fanin.push_back(repr[node(fanin(n, i))] ^ (is_neg(fanin(n, i)) ? 1 : 0));
+            }
+            repr[n] = kind[n] == Kind::AND ? res.mk_and(new_fanin) : res.mk_xor(new_fanin[0], new_fanin[1]);
+        }
+        lit l = repr[n];
+        std::vector<uint64_t> key = canonical(n);
+        auto it = classes.find(key);
+        if (it == classes.end()) {
+            classes.emplace(key, l ^ (phase(n) ? 1 : 0));
+            continue;
+        }
+        lit candidate = it->second ^ (phase(n) ? 1 : 0);
+        if (node(candidate) == node(l)) {
+            continue;
+        }
+        z3::expr_vector assumption(ctx);
+        assumption.push_back(var(l) != var(candidate));
+        if (solver.check(assumption) == z3::unsat) {
+            repr[n] = candidate;
+        }
+    }
+
+    for (auto& root : roots) {
+        root = repr[node(root)] ^ (is_neg(root) ? 1 : 0);
+    }
+    return res;
+}
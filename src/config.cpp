@@ -0,0 +1,181 @@
+#include "config.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "trace.hpp"
+#include "utils.hpp"
+
+size_t Instance_features::get(const std::string& name) const {
+    if (name == "universals") {
+        return universals;
+    } else if (name == "dep0") {
+        return dep_0;
+    } else if (name == "dep1") {
+        return dep_1;
+    } else if (name == "shared") {
+        return shared;
+    } else if (name == "overlap") {
+        return overlap;
+    } else if (name == "dag") {
+        return dag_size;
+    } else if (name == "conjuncts") {
+        return conjuncts;
+    } else if (name == "cnf") {
+        return cnf;
+    }
+    throw DQBF_error("Unknown feature " + name);
+}
+
+std::string Instance_features::to_string() const {
+    return "universals=" + std::to_string(universals) + " dep0=" + std::to_string(dep_0) + " dep1=" + std::to_string(dep_1) +
+           " shared=" + std::to_string(shared) + " overlap=" + std::to_string(overlap) + " dag=" + std::to_string(dag_size) +
+           " conjuncts=" + std::to_string(conjuncts) + " cnf=" + std::to_string(cnf);
+}
+
+Instance_features instance_features(DQBF& p) {
+    Trace_Scope scope("instance_features");
+    Instance_features f;
+    f.universals = p.u_vars.size();
+    if (p.e_vars.size() == 2) {
+        f.dep_0 = p.e_deps[0].count();
+        f.dep_1 = p.e_deps[1].count();
+        f.shared = (p.e_deps[0] & p.e_deps[1]).count();
+        size_t joint = (p.e_deps[0] | p.e_deps[1]).count();
+        f.overlap = joint == 0 ? 0 : 100 * f.shared / joint;
+    }
+    f.dag_size = p.circuit.cone_size(p.phi_lit);
+
+    if (p.conjuncts.empty()) {
+        p.set_phi(p.phi_lit);
+    }
+    f.conjuncts = p.conjuncts.size();
+    // A clause is a literal of an input or the complement of an AND of input literals
+    auto is_input = [&](Circuit::lit l) {
+        return p.circuit.kind[Circuit::node(l)] == Circuit::INPUT;
+    };
+    f.cnf = std::all_of(p.conjuncts.begin(), p.conjuncts.end(), [&](Circuit::lit l) {
+        uint32_t n = Circuit::node(l);
+        if (is_input(l)) {
+            return true;
+        }
+        if (!Circuit::is_neg(l) || p.circuit.kind[n] != Circuit::AND) {
+            return false;
+        }
+        for (size_t i = 0; i < p.circuit.num_fanins(n); i++) {
+            if (!is_input(p.circuit.fanin(n, i))) {
+                return false;
+            }
+        }
+        return true;
+    });
+    return f;
+}
+
+Config_table::Rule Config_table::parse_rule(const std::string& line, uint line_cnt) {
+    static const std::vector<std::string> ops = {"<=", ">=", "!=", "<", ">", "="};
+    Rule rule;
+    std::vector<std::string> parts = split_string(line, " \t");
+    for (auto& part : parts) {
+        rule.text += (rule.text.empty() ? "" : " ") + part;
+    }
+    auto arrow = std::find(parts.begin(), parts.end(), "->");
+    if (arrow == parts.end()) {
+        parse_err_msg(line_cnt, "Missing ->");
+    }
+    for (auto it = parts.begin(); it != arrow; it++) {
+        if (*it == "default") {
+            continue;
+        }
+        Condition c;
+        for (auto& op : ops) {
+            size_t pos = it->find(op);
+            if (pos != std::string::npos) {
+                c.feature = it->substr(0, pos);
+                c.op = op;
+                try {
+                    c.value = std::stoul(it->substr(pos + op.size()));
+                } catch (const std::exception&) {
+                    parse_err_msg(line_cnt, ("Bad value in " + *it).c_str());
+                }
+                break;
+            }
+        }
+        if (c.op.empty()) {
+            parse_err_msg(line_cnt, ("Bad condition " + *it).c_str());
+        }
+        try {
+            Instance_features().get(c.feature);
+        } catch (const DQBF_error& e) {
+            parse_err_msg(line_cnt, e.what());
+        }
+        rule.conditions.push_back(c);
+    }
+    for (auto it = arrow + 1; it != parts.end(); it++) {
+        size_t pos = it->find('=');
+        if (pos == std::string::npos || pos == 0) {
+            parse_err_msg(line_cnt, ("Bad option " + *it).c_str());
+        }
+        std::string key = it->substr(0, pos);
+        bool positional = key.size() > 3 && key.rfind("arg", 0) == 0 && std::all_of(key.begin() + 3, key.end(), ::isdigit);
+        if (key != "timeout" && key != "memout" && key != "abstraction" && !positional) {
+            parse_err_msg(line_cnt, ("Unknown option " + key).c_str());
+        }
+        rule.options[key] = it->substr(pos + 1);
+        if (key == "timeout" || key == "memout") {
+            try {
+                if (std::stoi(rule.options[key]) <= 0) {
+                    throw std::out_of_range(key);
+                }
+            } catch (const std::exception&) {
+                parse_err_msg(line_cnt, ("Bad value in " + *it).c_str());
+            }
+        }
+    }
+    return rule;
+}
+
+void Config_table::load(const std::string& path) {
+    Trace_Scope scope("Config_table::load");
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw DQBF_error("Cannot open file " + path);
+    }
+    rules.clear();
+    std::string line;
+    uint line_cnt = 0;
+    while (getline(file, line)) {
+        line_cnt++;
+        line = line.substr(0, line.find('#'));
+        if (split_string(line, " \t").empty()) {
+            continue;
+        }
+        rules.push_back(parse_rule(line, line_cnt));
+    }
+}
+
+AVR_config Config_table::select(const Instance_features& f, std::string& rule) const {
+    for (auto& r : rules) {
+        bool match = std::all_of(r.conditions.begin(), r.conditions.end(), [&](const Condition& c) {
+            size_t v = f.get(c.feature);
+            if (c.op == "<") {
+                return v < c.value;
+            } else if (c.op == "<=") {
+                return v <= c.value;
+            } else if (c.op == ">") {
+                return v > c.value;
+            } else if (c.op == ">=") {
+                return v >= c.value;
+            } else if (c.op == "=") {
+                return v == c.value;
+            }
+            return v != c.value;
+        });
+        if (match) {
+            rule = r.text;
+            return r.options;
+        }
+    }
+    rule = "";
+    return {};
+}
@@ -0,0 +1,248 @@
+#include "decompose.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+
+#include "trace.hpp"
+#include "utils.hpp"
+
+std::vector<Component> components(DQBF& p) {
+    Trace_Scope scope("components");
+    if (p.conjuncts.empty()) {
+        p.set_phi(p.phi_lit);
+    }
+
+    // Nested ANDs are split as well
+    std::vector<Circuit::lit> todo = p.conjuncts;
+    std::vector<Circuit::lit> conjuncts;
+    while (!todo.empty()) {
+        Circuit::lit l = todo.back();
+        todo.pop_back();
+        uint32_t n = Circuit::node(l);
+        if (!Circuit::is_neg(l) && p.circuit.kind[n] == Circuit::AND) {
+            for (size_t i = 0; i < p.circuit.num_fanins(n); i++) {
+                todo.push_back(p.circuit.fanin(n, i));
+            }
+        } else if (l != Circuit::TRUE) {
+            conjuncts.push_back(l);
+        }
+    }
+
+    // Union-find over the variables (input i of the circuit is the variable with id i)
+    std::vector<uint32_t> parent(p.var_names.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    std::function<uint32_t(uint32_t)> find = [&](uint32_t v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    };
+    std::vector<bool> used(p.var_names.size(), false);
+    std::vector<std::vector<uint32_t>> supports;
+    for (auto c : conjuncts) {
+        supports.push_back(p.circuit.support(c));
+        for (auto v : supports.back()) {
+            used[v] = true;
+            parent[find(v)] = find(supports.back()[0]);
+        }
+    }
+
+    std::vector<Component> res;
+    std::unordered_map<uint32_t, size_t> comp_of;  // root -> component
+    auto component = [&](uint32_t v) {
+        auto it = comp_of.find(find(v));
+        if (it != comp_of.end()) {
+            return it->second;
+        }
+        comp_of[find(v)] = res.size();
+        res.emplace_back();
+        return res.size() - 1;
+    };
+    // Constant conjuncts share one component without variables
+    std::optional<size_t> constants;
+    for (size_t i = 0; i < conjuncts.size(); i++) {
+        if (supports[i].empty()) {
+            if (!constants) {
+                constants = res.size();
+                res.emplace_back();
+            }
+            res[*constants].conjuncts.push_back(conjuncts[i]);
+        } else {
+            res[component(supports[i][0])].conjuncts.push_back(conjuncts[i]);
+        }
+    }
+    for (uint32_t v = 0; v < p.var_names.size(); v++) {
+        if (used[v]) {
+            res[component(v)].vars.push_back(v);
+        }
+    }
+    for (size_t k = 0; k < p.e_vars.size(); k++) {
+        if (used[p.e_vars[k]]) {
+            res[component(p.e_vars[k])].e_idx.push_back(k);
+        }
+    }
+    return res;
+}
+
+void build_component(DQBF& p, const Component& c, DQBF& sub) {
+    std::unordered_map<uint32_t, uint32_t> sub_id;
+    std::unordered_map<uint32_t, Circuit::lit> map;
+    for (auto v : c.vars) {
+        if (std::find(p.u_vars.begin(), p.u_vars.end(), v) != p.u_vars.end()) {
+            sub_id[v] = sub.add_universal(p.var_names[v]);
+        }
+    }
+    for (auto k : c.e_idx) {
+        std::vector<uint32_t> deps;
+        for (auto v : p.deps(k)) {
+            if (sub_id.count(v)) {
+                deps.push_back(sub_id[v]);
+            }
+        }
+        sub_id[p.e_vars[k]] = sub.add_existential(p.var_names[p.e_vars[k]], deps);
+    }
+    if (c.e_idx.size() == 1) {
+        std::string name = p.var_names[p.e_vars[c.e_idx[0]]] + "$dummy";
+        while (sub.var_ids.count(name)) {
+            name += "_";
+        }
+        sub.add_existential(name, {});
+    }
+    for (auto& [v, id] : sub_id) {
+        map[p.circuit.input_nodes[v]] = sub.lit(id);
+    }
+
+    std::vector<Circuit::lit> conjuncts;
+    for (auto l : c.conjuncts) {
+        conjuncts.push_back(sub.circuit.add_cone(p.circuit, l, map));
+    }
+    sub.set_phi(sub.circuit.mk_and(conjuncts));
+}
+
+Solve_result solve_components(DQBF& p, const Solve_options& options) {
+    Log_scope log(options.log);
+    Trace_Scope scope("solve_components");
+    int64_t start = Tracer::now();
+    if (options.resume) {
+        throw DQBF_error("Resuming from a checkpoint is not supported with decompose");
+    }
+    Solve_options whole = options;
+    whole.decompose = false;
+
+    std::vector<Component> comps = components(p);
+    if (comps.size() <= 1) {
+        return solve(p, whole);
+    }
+    print_info(("phi has " + std::to_string(comps.size()) + " independent components").c_str());
+
+    Solve_result res;
+    res.verdict = AVR_result::SAT;
+    std::vector<z3::expr> inputs;
+    for (uint32_t i = 0; i < p.var_names.size(); i++) {
+        inputs.push_back(p.var(i));
+    }
+
+    // Components without existentials must be valid
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < comps.size(); i++) {
+        if (!comps[i].e_idx.empty()) {
+            todo.push_back(i);
+            continue;
+        }
+        z3::expr_vector conj(p.ctx);
+        for (auto l : comps[i].conjuncts) {
+            conj.push_back(p.circuit.to_expr(p.ctx, l, inputs));
+        }
+        z3::solver solver(p.ctx);
+        solver.add(!z3::mk_and(conj));
+        if (solver.check() != z3::unsat) {
+            print_info("A component without existential variables is not valid");
+            print_info("UNSAT");
+            res.verdict = AVR_result::UNSAT;
+            res.stats.total_time = (Tracer::now() - start) / 1e6;
+            return res;
+        }
+    }
+
+    // The others are solved in parallel, each with its own DQBF (and z3 context) and work directory
+    std::vector<std::unique_ptr<DQBF>> subs;
+    for (auto i : todo) {
+        subs.push_back(std::make_unique<DQBF>());
+        build_component(p, comps[i], *subs.back());
+    }
+    std::vector<Solve_result> results(todo.size());
+    std::vector<std::exception_ptr> errors(todo.size());
+    std::vector<std::thread> threads;
+    for (size_t j = 0; j < todo.size(); j++) {
+        Solve_options sub_options = whole;
+        sub_options.work_dir = options.work_dir.empty() ? "" : (std::filesystem::path(options.work_dir) / ("component_" + std::to_string(j))).string();
+        sub_options.output_dir = "";
+        sub_options.load_lemmas = "";
+        sub_options.save_lemmas = "";
+        threads.emplace_back([&, j, sub_options]() {
+            try {
+                results[j] = solve(*subs[j], sub_options);
+            } catch (...) {
+                errors[j] = std::current_exception();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+
+    for (auto& r : results) {
+        if (r.verdict == AVR_result::UNSAT) {
+            res.verdict = AVR_result::UNSAT;
+        } else if (r.verdict != AVR_result::SAT && res.verdict == AVR_result::SAT) {
+            res.verdict = r.verdict;
+        }
+        res.stats.avr_runs += r.stats.avr_runs;
+        res.stats.patches += r.stats.patches;
+        res.stats.avr_time += r.stats.avr_time;
+        // Set if some component was answered that way
+        res.stats.reused = res.stats.reused || r.stats.reused;
+        res.stats.filtered = res.stats.filtered || r.stats.filtered;
+        res.stats.expanded = res.stats.expanded || r.stats.expanded;
+        res.stats.bmc = res.stats.bmc || r.stats.bmc;
+    }
+    print_info(res.verdict == AVR_result::SAT ? "SAT" : res.verdict == AVR_result::UNSAT ? "UNSAT" : "Timeout");
+
+    if (res.verdict == AVR_result::SAT && options.skolem) {
+        // Existentials that do not occur in phi are constant
+        std::vector<z3::expr> f = {p.ctx.bool_val(false), p.ctx.bool_val(false)};
+        for (size_t j = 0; j < todo.size(); j++) {
+            z3::expr_vector skolem(subs[j]->ctx);
+            for (auto& e : results[j].skolem) {
+                skolem.push_back(e);
+            }
+            z3::expr_vector translated(p.ctx, skolem);
+            for (size_t i = 0; i < comps[todo[j]].e_idx.size(); i++) {
+                f[comps[todo[j]].e_idx[i]] = translated[i];
+            }
+        }
+        z3::solver solver(p.ctx);
+        solver.add(!p.phi());
+        solver.add(p.var(p.e_vars[0]) == f[0] && p.var(p.e_vars[1]) == f[1]);
+        if (solver.check() != z3::unsat) {
+            throw DQBF_error("Combined Skolem functions do not satisfy phi");
+        }
+        if (options.output_dir != "") {
+            save_proof(p, f[0], f[1], (std::filesystem::path(options.output_dir) / "proof.smt2").string());
+        }
+        res.skolem = f;
+    }
+    res.stats.total_time = (Tracer::now() - start) / 1e6;
+    return res;
+}
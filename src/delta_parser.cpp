@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <iostream>
+
+#include "DQBF.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+// Read one batch of matrix edits:
+//   name = op(inputs...)   define a gate (dqcir syntax, inputs may be variables or gates)
+//   + <conjunct>           add a top-level conjunct of phi
+//   - <conjunct>           remove a top-level conjunct of phi
+//   solve                  end of the batch
+// A conjunct is a clause "l1 l2 ... 0" (dqdimacs syntax) or a single, possibly negated, gate or variable.
+bool DQBF::read_delta(std::istream& file) {
+    Trace_Scope scope("DQBF::read_delta");
+    uint& line_cnt = delta_line;
+    std::string line;
+    std::vector<std::string> parts;
+    bool batch = false;
+
+    if (conjuncts.empty()) {
+        set_phi(phi_lit);
+    }
+
+    while (getline(file, line)) {
+        line_cnt++;
+        if (line[0] == '#') {
+            continue;
+        }
+        parts = split_string(line, "= (),\n\r");
+        if (parts.empty()) {
+            continue;
+        }
+        batch = true;
+        if (parts[0] == "solve") {
+            break;
+        } else if (parts[0] == "+" || parts[0] == "-") {
+            if (parts.size() < 2) {
+                parse_err_msg(line_cnt, "Missing conjunct");
+            }
+            Circuit::lit c;
+            if (parts.back() == "0" && parts.size() > 2) {
+                std::vector<Circuit::lit> clause;
+                for (auto it = parts.begin() + 1; it < parts.end() - 1; it++) {
+                    clause.push_back(gate_lit(*it, line_cnt));
+                }
+                c = circuit.mk_or(clause);
+            } else if (parts.size() == 2) {
+                c = gate_lit(parts[1], line_cnt);
+            } else {
+                parse_err_msg(line_cnt, "Clause must end with 0");
+            }
+            if (parts[0] == "+") {
+                conjuncts.push_back(c);
+            } else {
+                auto it = std::find(conjuncts.begin(), conjuncts.end(), c);
+                if (it == conjuncts.end()) {
+                    print_warning(("line " + std::to_string(line_cnt) + ": conjunct to remove is not in phi").c_str());
+                } else {
+                    conjuncts.erase(it);
+                }
+            }
+        } else if (parts.size() > 2) {
+            define_gate(parts, line_cnt);
+        } else {
+            parse_err_msg(line_cnt, "Unknown delta command");
+        }
+    }
+
+    if (batch) {
+        phi_lit = circuit.mk_and(conjuncts);
+        phi_expr.reset();
+    }
+    return batch;
+}
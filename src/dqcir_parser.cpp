@@ -5,31 +5,32 @@
 #include <iostream>
 
 #include "DQBF.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
-// Read from dqcir file
+// Read from dqcir file, possibly compressed (.gz, .xz, .zst) or "-" for stdin
 void DQBF::from_dqcir(std::string path) {
     if (!path.size()) {
-        throw std::runtime_error("ERROR: No file given");
+        throw DQBF_error("No file given");
     }
-    if (split_string(path, ".").back() != "dqcir") {
+    if (path != "-" && input_format(path) != "dqcir") {
         printf("WARNING: File does not ends in .dqcir");
     }
-    std::ifstream file(path);
-    if (!file) {
-        throw std::runtime_error("Error on opening file");
-    }
+    std::unique_ptr<std::istream> file = open_input(path);
+    from_dqcir(*file);
+}
 
+// Read from a dqcir stream
+void DQBF::from_dqcir(std::istream& file) {
+    Trace_Scope scope("DQBF::from_dqcir");
     uint line_cnt = 0;
     std::string line;
     std::vector<std::string> parts;
 
     var_cnt = 0;
-    z3::expr output(ctx);
     std::string output_str;
 
-    z3::expr_vector gates(ctx);
-    std::unordered_map<std::string, int> str_to_idx;
+    std::unordered_map<std::string, uint32_t> u_idx;
 
     // Read U/E variables
     while (getline(file, line)) {
@@ -38,33 +39,31 @@ void DQBF::from_dqcir(std::string path) {
             continue;
         }
         parts = split_string(line, "= (),\n\r");
+        if (parts.empty()) {
+            continue;
+        }
         if (parts[0] == "forall") {
-            parts = split_string(line, "= (),\n\r");
             for (auto it = parts.begin() + 1; it < parts.end(); it++) {
-                u_vars.push_back(ctx.bool_const((*it).c_str()));
-                u_vars_str.push_back(*it);
-                gates.push_back(ctx.bool_const((*it).c_str()));
-                str_to_idx[*it] = gates.size() - 1;
+                u_idx[*it] = u_vars.size();
+                u_vars.push_back(add_var(*it));
             }
         } else if (parts[0] == "depend") {
-            e_vars.emplace_back(ctx.bool_const(parts[1].c_str()), std::vector<z3::expr>());
-            e_vars_str.emplace_back(parts[1], std::vector<std::string>());
+            e_vars.push_back(add_var(parts[1]));
+            e_deps.emplace_back(u_vars.size());
             for (auto it = parts.begin() + 2; it < parts.end(); it++) {
-                e_vars.back().second.push_back(ctx.bool_const((*it).c_str()));
-                e_vars_str.back().second.push_back(*it);
+                if (u_idx.find(*it) == u_idx.end()) {
+                    parse_err_msg(line_cnt, "Dependency is not a universal variable");
+                }
+                e_deps.back().set(u_idx[*it]);
             }
-            gates.push_back(ctx.bool_const(parts[1].c_str()));
-            str_to_idx[parts[1]] = gates.size() - 1;
 
         } else if (parts[0] == "exists") {
             for (auto it = parts.begin() + 1; it < parts.end(); it++) {
-                e_vars.emplace_back(ctx.bool_const((*it).c_str()), std::vector<z3::expr>(u_vars));
-                e_vars_str.emplace_back(*it, std::vector<std::string>(u_vars_str));
-                gates.push_back(ctx.bool_const((*it).c_str()));
-                str_to_idx[*it] = gates.size() - 1;
+                e_vars.push_back(add_var(*it));
+                e_deps.emplace_back(u_vars.size());
+                e_deps.back().set();
             }
         } else if (parts[0] == "output") {
-            output = ctx.bool_const(parts[1].c_str());
             output_str = parts[1];
             break;
         } else {
@@ -73,46 +72,67 @@ void DQBF::from_dqcir(std::string path) {
     }
 
     var_cnt = u_vars.size() + e_vars.size();
-
-    z3::expr_vector phi_vec(ctx);
-    z3::expr_vector tmp(ctx);
-    std::string name;
-
-    std::function<z3::expr(z3::expr_vector)> mk_not = [](z3::expr_vector v) { return !v[0]; };
-    std::function<z3::expr(z3::expr_vector)> mk_nand = [](z3::expr_vector v) { return !z3::mk_and(v); };
-    std::function<z3::expr(z3::expr_vector)> mk_nor = [](z3::expr_vector v) { return !z3::mk_or(v); };
-    std::function<z3::expr(z3::expr_vector)> mk_xor = [](z3::expr_vector v) {
-        assert(v.size() == 2);
-        return v[0] ^ v[1];
-    };
-
-    std::unordered_map<std::string, std::function<z3::expr(z3::expr_vector)>> func_map = {{"and", z3::mk_and}, {"or", z3::mk_or}, {"not", mk_not}, {"nand", mk_nand}, {"nor", mk_nor}, {"xor", mk_xor}};
+    // Universal variables declared after an existential one
+    for (auto& d : e_deps) {
+        d.resize(u_vars.size());
+    }
 
     while (getline(file, line)) {
         line_cnt++;
         if (line[0] != '#' && line[0] != '\n' && line[0] != '\r') {
             parts = split_string(line, "= (),\n\r");
-            tmp.resize(0);
-            if (func_map.find(parts[1]) != func_map.end()) {
-                for (int i = 2; i < parts.size(); i++) {
-                    name = parts[i];
-                    if (name[0] != '-') {
-                        assert(str_to_idx.find(name) != str_to_idx.end());
-                        tmp.push_back(gates[str_to_idx[name]]);
-                    } else {
-                        name = name.substr(1, name.size() - 1);
-                        assert(str_to_idx.find(name) != str_to_idx.end());
-                        tmp.push_back(!gates[str_to_idx[name]]);
-                    }
-                }
-                gates.push_back(func_map[parts[1]](tmp));
-                str_to_idx[parts[0]] = gates.size() - 1;
-
-            } else {
-                parse_err_msg(line_cnt, "Unsupported operator");
+            if (parts.size() < 2) {
+                continue;
             }
+            define_gate(parts, line_cnt);
         }
     }
 
-    phi = gates[str_to_idx[output_str]].simplify();
-};
\ No newline at end of file
+    if (gates.find(output_str) == gates.end() && var_ids.find(output_str) == var_ids.end()) {
+        parse_err_msg(line_cnt, "Undefined output gate");
+    }
+    set_phi(gate_lit(output_str, line_cnt));
+};
+
+// Literal of a (possibly negated, "-name") gate or variable
+Circuit::lit DQBF::gate_lit(std::string name, uint line_cnt) {
+    bool neg = name[0] == '-';
+    if (neg) {
+        name = name.substr(1, name.size() - 1);
+    }
+    auto it = gates.find(name);
+    if (it != gates.end()) {
+        return it->second ^ (neg ? 1 : 0);
+    }
+    auto v = var_ids.find(name);
+    if (v == var_ids.end()) {
+        parse_err_msg(line_cnt, "Undefined gate");
+    }
+    return lit(v->second) ^ (neg ? 1 : 0);
+}
+
+// Gate definition, (name, operator, inputs...)
+void DQBF::define_gate(const std::vector<std::string>& parts, uint line_cnt) {
+    std::vector<Circuit::lit> tmp;
+    for (int i = 2; i < parts.size(); i++) {
+        tmp.push_back(gate_lit(parts[i], line_cnt));
+    }
+    if (parts[1] == "and") {
+        gates[parts[0]] = circuit.mk_and(tmp);
+    } else if (parts[1] == "or") {
+        gates[parts[0]] = circuit.mk_or(tmp);
+    } else if (parts[1] == "not") {
+        gates[parts[0]] = tmp[0] ^ 1;
+    } else if (parts[1] == "nand") {
+        gates[parts[0]] = circuit.mk_and(tmp) ^ 1;
+    } else if (parts[1] == "nor") {
+        gates[parts[0]] = circuit.mk_or(tmp) ^ 1;
+    } else if (parts[1] == "xor") {
+        if (tmp.size() != 2) {
+            parse_err_msg(line_cnt, "xor expects two inputs");
+        }
+        gates[parts[0]] = circuit.mk_xor(tmp[0], tmp[1]);
+    } else {
+        parse_err_msg(line_cnt, "Unsupported operator");
+    }
+}
@@ -4,21 +4,24 @@
 #include <iostream>
 
 #include "DQBF.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
-// Read from dqdimacs file
+// Read from dqdimacs file, possibly compressed (.gz, .xz, .zst) or "-" for stdin
 void DQBF::from_dqdimacs(std::string path) {
     if (!path.size()) {
-        throw std::runtime_error("ERROR: No file given");
+        throw DQBF_error("No file given");
     }
-    if (split_string(path, ".").back() != "dqdimacs") {
+    if (path != "-" && input_format(path) != "dqdimacs") {
         printf("WARNING: File does not ends in .dqdimacs");
     }
-    std::ifstream file(path);
-    if (!file) {
-        throw std::runtime_error("Error on opening file");
-    }
+    std::unique_ptr<std::istream> file = open_input(path);
+    from_dqdimacs(*file);
+}
 
+// Read from a dqdimacs stream
+void DQBF::from_dqdimacs(std::istream& file) {
+    Trace_Scope scope("DQBF::from_dqdimacs");
     uint line_cnt = 0;
     std::string line;
     std::vector<std::string> parts;
@@ -52,6 +55,7 @@ void DQBF::from_dqdimacs(std::string path) {
     }
 
     // Read U/E variables
+    std::unordered_map<std::string, uint32_t> u_idx;
     while (getline(file, line)) {
         line_cnt++;
         parts = split_string(line, " ");
@@ -59,22 +63,27 @@ void DQBF::from_dqdimacs(std::string path) {
             try {
                 if (parts[0] == "a") {
                     for (auto it = parts.begin() + 1; it < parts.end() - 1; it++) {
-                        u_vars.push_back(ctx.bool_const((*it).c_str()));
-                        u_vars_str.push_back(*it);
+                        u_idx[*it] = u_vars.size();
+                        u_vars.push_back(add_var(*it));
                     }
                 } else if (parts[0] == "e") {
                     for (auto it = parts.begin() + 1; it < parts.end() - 1; it++) {
-                        e_vars.emplace_back(ctx.bool_const((*it).c_str()), std::vector<z3::expr>(u_vars));
-                        e_vars_str.emplace_back(*it, std::vector<std::string>(u_vars_str));
+                        e_vars.push_back(add_var(*it));
+                        e_deps.emplace_back(u_vars.size());
+                        e_deps.back().set();
                     }
                 } else if (parts[0] == "d") {
-                    e_vars.emplace_back(ctx.bool_const(parts[1].c_str()), std::vector<z3::expr>());
-                    e_vars_str.emplace_back(parts[1], std::vector<std::string>());
+                    e_vars.push_back(add_var(parts[1]));
+                    e_deps.emplace_back(u_vars.size());
                     for (auto it = parts.begin() + 2; it < parts.end() - 1; it++) {
-                        e_vars.back().second.push_back(ctx.bool_const((*it).c_str()));
-                        e_vars_str.back().second.push_back(*it);
+                        if (u_idx.find(*it) == u_idx.end()) {
+                            parse_err_msg(line_cnt, "Dependency is not a universal variable");
+                        }
+                        e_deps.back().set(u_idx[*it]);
                     }
                 }
+            } catch (const DQBF_error&) {
+                throw;
             } catch (const std::exception& e) {
                 parse_err_msg(line_cnt, e.what());
             }
@@ -87,9 +96,12 @@ void DQBF::from_dqdimacs(std::string path) {
     if (u_vars.size() + e_vars.size() != var_cnt) {
         parse_err_msg(line_cnt, "Wrong number of variables");
     }
+    for (auto& d : e_deps) {
+        d.resize(u_vars.size());
+    }
 
-    z3::expr_vector clauses(ctx);
-    z3::expr_vector clause(ctx);
+    std::vector<Circuit::lit> clauses;
+    std::vector<Circuit::lit> clause;
 
     for (int i = 0; i < clause_cnt; i++) {
         if (!getline(file, line)) {
@@ -100,19 +112,23 @@ void DQBF::from_dqdimacs(std::string path) {
         clause.resize(0);
         try {
             for (auto it = parts.begin(); it < parts.end() - 1; it++) {
-                if ((*it)[0] == '-') {
-                    clause.push_back(!ctx.bool_const(std::string((*it).begin() + 1, (*it).end()).c_str()));
-                } else {
-                    clause.push_back(ctx.bool_const((*it).c_str()));
+                bool neg = (*it)[0] == '-';
+                auto v = var_ids.find(neg ? std::string((*it).begin() + 1, (*it).end()) : *it);
+                if (v == var_ids.end()) {
+                    parse_err_msg(line_cnt, "Unknown variable");
                 }
+                clause.push_back(Circuit::mk_lit(circuit.input_nodes[v->second], neg));
             }
-            clauses.push_back(z3::mk_or(clause));
+            clauses.push_back(circuit.mk_or(clause));
+        } catch (const DQBF_error&) {
+            throw;
         } catch (const std::exception& e) {
             parse_err_msg(line_cnt, e.what());
         }
     }
 
-    phi = z3::mk_and(clauses);
+    conjuncts = clauses;
+    phi_lit = circuit.mk_and(clauses);
     if (clauses.size() != clause_cnt) {
         parse_err_msg(line_cnt, "Wrong number of clauses");
     }
@@ -6,16 +6,33 @@
 #include <string>
 
 #include "DQBF.hpp"
-#include "algorithm.hpp"
+#include "solver.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 int main(int argc, char** argv) {
     cxxopts::Options options("2dqr", "2DQR");
 
-    options.add_options()   ("i,input", "Input File", cxxopts::value<std::string>())
+    options.add_options()   ("i,input", "Input File (.dqcir/.dqdimacs, optionally .gz/.xz/.zst compressed, - for stdin)", cxxopts::value<std::string>())
                             ("skolem", "Generate Skolem Function", cxxopts::value<bool>()->default_value("false"))
+                            ("minimise", "Minimise the Skolem functions with phi as the care set", cxxopts::value<bool>()->default_value("false"))
                             ("o,output", "Output Path", cxxopts::value<std::string>()->default_value("./"))
+                            ("resume", "Continue the Skolem refinement from the checkpoint in the output path", cxxopts::value<bool>()->default_value("false"))
                             ("avr_bin", "Path to AVR binaries", cxxopts::value<std::string>()->default_value("../avr/build"))
+                            ("encoding", "Transition system encoding: bv, bits (one state variable per bit), frozen (target fields as frozen state) or inline (phi inlined)", cxxopts::value<std::string>()->default_value("bv"))
+                            ("decompose", "Solve the independent components of phi separately, in parallel", cxxopts::value<bool>()->default_value("false"))
+                            ("filter_timeout", "Time limit in ms of each QBF filter check before the encoding (0 = no filters)", cxxopts::value<int>()->default_value("0"))
+                            ("expansion_budget", "Decide by universal expansion if the expanded size (copies of phi times its size) is at most this (0 = never)", cxxopts::value<size_t>()->default_value("0"))
+                            ("expansion_timeout", "Time limit in ms of the universal expansion", cxxopts::value<int>()->default_value("10000"))
+                            ("bmc_timeout", "Time limit in ms of bounded model checking before AVR (0 = no BMC)", cxxopts::value<int>()->default_value("0"))
+                            ("avr_timeout", "Wall-clock limit for each AVR run in seconds", cxxopts::value<int>()->default_value("600"))
+                            ("avr_stall", "Kill AVR if it prints nothing for this many seconds (0 = never)", cxxopts::value<int>()->default_value("0"))
+                            ("config", "Rule table selecting the AVR options from the instance features (opt-in, AVR defaults without it)", cxxopts::value<std::string>()->default_value(""))
+                            ("heartbeat", "Rewrite file with the progress of AVR every second", cxxopts::value<std::string>())
+                            ("save_lemmas", "Save the invariant lemmas of a SAT run to file", cxxopts::value<std::string>()->default_value(""))
+                            ("load_lemmas", "Seed the run with the inductive lemmas from file", cxxopts::value<std::string>())
+                            ("deltas", "After solving the input, apply the matrix edits from file and re-solve after each batch", cxxopts::value<std::string>())
+                            ("trace", "Write a Chrome/Perfetto trace of the run to file", cxxopts::value<std::string>())
                             ("h,help", "Print usage");
 
     auto result = options.parse(argc, argv);
@@ -29,17 +46,72 @@ int main(int argc, char** argv) {
         printf("No input file specified\n");
         exit(0);
     }
+    if (result.count("trace")) {
+        Tracer::enable(result["trace"].as<std::string>());
+    }
     std::string input_file = result["input"].as<std::string>();
     print_info(("file = " + input_file).c_str());
-    DQBF p;
-    if (split_string(input_file, ".").back() == "dqcir") {
-        p.from_dqcir(input_file);
-    } else if (split_string(input_file, ".").back() == "dqdimacs") {
-        p.from_dqdimacs(input_file);
-    } else {
-        print_error("File extension must be either .dqdimacs or .dicir");
+    try {
+        DQBF p;
+        std::unique_ptr<std::istream> input = open_input(input_file);
+        std::string format = input_format(input_file, *input);
+        if (format == "dqcir") {
+            p.from_dqcir(*input);
+        } else if (format == "dqdimacs") {
+            p.from_dqdimacs(*input);
+        } else {
+            throw DQBF_error("File extension must be either .dqdimacs or .dqcir (optionally followed by .gz, .xz or .zst)");
+        }
+
+        Solve_options solve_options;
+        solve_options.skolem = result["skolem"].as<bool>();
+        solve_options.minimise = result["minimise"].as<bool>();
+        solve_options.avr_bin = result["avr_bin"].as<std::string>();
+        solve_options.work_dir = ".";
+        solve_options.log = log_to_stdout;
+        solve_options.output_dir = result["output"].as<std::string>();
+        solve_options.resume = result["resume"].as<bool>();
+        solve_options.encoding = encoding_from_string(result["encoding"].as<std::string>());
+        solve_options.decompose = result["decompose"].as<bool>();
+        solve_options.filter_timeout = result["filter_timeout"].as<int>();
+        solve_options.expansion_budget = result["expansion_budget"].as<size_t>();
+        solve_options.expansion_timeout = result["expansion_timeout"].as<int>();
+        solve_options.bmc_timeout = result["bmc_timeout"].as<int>();
+        solve_options.avr_timeout = result["avr_timeout"].as<int>();
+        solve_options.avr_stall = result["avr_stall"].as<int>();
+        solve_options.config = result["config"].as<std::string>();
+        if (result.count("heartbeat")) {
+            std::string heartbeat = result["heartbeat"].as<std::string>();
+            solve_options.on_progress = [heartbeat](const AVR_progress& progress) {
+                std::ofstream output(heartbeat);
+                output << "elapsed " << progress.elapsed << "\nframe " << progress.frame << "\nlemmas " << progress.lemmas << "\nbound " << progress.bound << "\n";
+            };
+        }
+        if (result.count("load_lemmas")) {
+            solve_options.load_lemmas = result["load_lemmas"].as<std::string>();
+        }
+        solve_options.save_lemmas = result["save_lemmas"].as<std::string>();
+
+        AVR_Wrapper::forward_signals();
+        if (!result.count("deltas")) {
+            solve(p, solve_options);
+        } else {
+            // Incremental solving keeps one encoding of the whole instance
+            solve_options.decompose = false;
+            Incremental_solver solver(p, solve_options);
+            solver.solve();
+            std::unique_ptr<std::istream> deltas = open_input(result["deltas"].as<std::string>());
+            int batch = 0;
+            while (p.read_delta(*deltas)) {
+                print_info(("Delta " + std::to_string(++batch)).c_str());
+                solver.solve();
+            }
+        }
+    } catch (const AVR_interrupted& e) {
+        print_info("Interrupted");
+        exit(128 + e.signal);
+    } catch (const std::exception& e) {
+        print_error(e.what());
+        exit(-1);
     }
-    AVR_Wrapper avr(result["avr_bin"].as<std::string>());
-    Algorithm Algorithm(p, avr);
-    Algorithm.run(result["skolem"].as<bool>());
 }
@@ -0,0 +1,135 @@
+#include "solver.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+#include "algorithm.hpp"
+#include "config.hpp"
+#include "decompose.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+void save_proof(DQBF& p, const z3::expr& f_0, const z3::expr& f_1, const std::string& path) {
+    Trace_Scope scope("save_proof");
+    std::ofstream proof(path);
+    proof << "; Declare variables\n";
+    for (auto& u : p.u_vars) {
+        proof << "(declare-const " << p.var(u) << " Bool)\n";
+    }
+    proof << "\n";
+
+    proof << "; Skolem function for y0\n";
+    proof << "(define-fun " + p.var_names[p.e_vars[0]] + " () Bool\n";
+    proof << f_0.simplify();
+    proof << ")\n\n";
+
+    proof << "; Skolem function for y1\n";
+    proof << "(define-fun " + p.var_names[p.e_vars[1]] + " () Bool\n";
+    proof << f_1.simplify();
+    proof << ")\n\n";
+
+    proof << "; 2DQBF phi\n";
+    proof << "(define-fun phi () Bool\n";
+    proof << p.phi().simplify();
+    proof << ")\n\n";
+
+    proof << "(assert (not phi))\n(check-sat)";
+    proof.close();
+}
+
+Encoding encoding_from_string(const std::string& name) {
+    if (name == "bv") {
+        return Encoding::BV;
+    } else if (name == "bits") {
+        return Encoding::BITS;
+    } else if (name == "frozen") {
+        return Encoding::FROZEN;
+    } else if (name == "inline") {
+        return Encoding::INLINE_PHI;
+    }
+    throw DQBF_error("Unknown encoding " + name + " (expected bv, bits, frozen or inline)");
+}
+
+Incremental_solver::Incremental_solver(DQBF& p, const Solve_options& options) : p(p), options(options) {
+    Log_scope log(this->options.log);
+    // Every solver gets its own work directory, so that concurrent AVR runs do not share files
+    static std::atomic<int> call_cnt(0);
+    work_dir = options.work_dir;
+    temporary = work_dir.empty();
+    if (temporary) {
+        work_dir = std::filesystem::temp_directory_path() / ("2dqr-" + std::to_string(getpid()) + "-" + std::to_string(call_cnt++));
+    }
+    std::filesystem::create_directories(work_dir);
+
+    try {
+        avr = std::make_unique<AVR_Wrapper>(options.avr_bin);
+        avr->work_dir = work_dir.string();
+        avr->timeout = options.avr_timeout;
+        avr->stall_timeout = options.avr_stall;
+        avr->on_progress = options.on_progress;
+        avr->log = options.log;
+
+        // The features are printed either way, e.g. to derive a rule table from batch runs
+        Instance_features features = instance_features(p);
+        print_info(("Features: " + features.to_string()).c_str());
+        if (options.config != "") {
+            Config_table table;
+            table.load(options.config);
+            std::string rule;
+            avr->options = table.select(features, rule);
+            print_info(("AVR configuration: " + (rule != "" ? rule : "no matching rule, AVR defaults")).c_str());
+            // A longer AVR time limit also raises the watchdog limit
+            auto timeout = avr->options.find("timeout");
+            if (timeout != avr->options.end()) {
+                avr->timeout = std::max(avr->timeout, std::stoi(timeout->second));
+            }
+        }
+
+        algorithm = std::make_unique<Algorithm>(p, *avr);
+        if (options.load_lemmas != "") {
+            algorithm->load_lemmas(options.load_lemmas);
+        }
+        if (options.resume && options.output_dir != "") {
+            algorithm->resume((std::filesystem::path(options.output_dir) / "checkpoint.smt2").string());
+        }
+    } catch (...) {
+        if (temporary) {
+            std::filesystem::remove_all(work_dir);
+        }
+        throw;
+    }
+}
+
+Incremental_solver::~Incremental_solver() {
+    algorithm.reset();
+    avr.reset();
+    if (temporary) {
+        std::filesystem::remove_all(work_dir);
+    }
+}
+
+Solve_result Incremental_solver::solve() {
+    Trace_Scope scope("solve");
+    Log_scope log(options.log);
+    int64_t start = Tracer::now();
+    if (solved && p.phi_lit != solved_lit) {
+        algorithm->matrix_changed();
+    }
+    Solve_result res = algorithm->run(options);
+    solved = true;
+    solved_lit = p.phi_lit;
+    res.stats.total_time = (Tracer::now() - start) / 1e6;
+    return res;
+}
+
+Solve_result solve(DQBF& p, const Solve_options& options) {
+    if (options.decompose) {
+        return solve_components(p, options);
+    }
+    Incremental_solver solver(p, options);
+    return solver.solve();
+}
@@ -0,0 +1,93 @@
+#include "trace.hpp"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+
+std::mutex Tracer::mtx;
+std::string Tracer::path;
+std::vector<Tracer::Event> Tracer::events;
+std::vector<std::pair<int, std::string>> Tracer::process_names;
+
+static std::string json_escape(const std::string& str) {
+    std::string out;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            out += c;
+        }
+    }
+    return out;
+}
+
+void Tracer::enable(std::string path) {
+    std::lock_guard<std::mutex> lock(mtx);
+    bool first = Tracer::path.empty();
+    Tracer::path = path;
+    process_names.emplace_back(getpid(), "2dqr");
+    if (first) {
+        // Also covers the paths that exit() early
+        std::atexit([] { Tracer::save(); });
+    }
+}
+
+bool Tracer::enabled() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return !path.empty();
+}
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::add_span(const std::string& name, const std::string& cat, int64_t ts, int64_t dur, int pid, int tid) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (path.empty()) {
+        return;
+    }
+    events.push_back({name, cat, ts, dur, pid, tid});
+}
+
+void Tracer::name_process(int pid, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (path.empty()) {
+        return;
+    }
+    process_names.emplace_back(pid, name);
+}
+
+void Tracer::save() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (path.empty()) {
+        return;
+    }
+    std::ofstream output(path);
+    if (!output.is_open()) {
+        printf("\033[93m[WARN]\033[0m Cannot open trace file %s\n", path.c_str());
+        return;
+    }
+    output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto& p : process_names) {
+        output << (first ? "" : ",\n") << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << p.first << ", \"tid\": 0, \"args\": {\"name\": \"" << json_escape(p.second) << "\"}}";
+        first = false;
+    }
+    for (auto& e : events) {
+        output << (first ? "" : ",\n") << "{\"name\": \"" << json_escape(e.name) << "\", \"cat\": \"" << json_escape(e.cat) << "\", \"ph\": \"X\", \"ts\": " << e.ts << ", \"dur\": " << e.dur << ", \"pid\": " << e.pid << ", \"tid\": " << e.tid << "}";
+        first = false;
+    }
+    output << "\n]}\n";
+    output.close();
+}
+
+Trace_Scope::Trace_Scope(std::string name, std::string cat) : name(name), cat(cat), start(Tracer::now()) {}
+
+Trace_Scope::~Trace_Scope() {
+    Tracer::add_span(name, cat, start, Tracer::now() - start, getpid(), gettid());
+}
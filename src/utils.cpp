@@ -3,6 +3,14 @@
 #include <sys/stat.h>
 #include <z3++.h>
 
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
 #include <vector>
 
 // https://stackoverflow.com/questions/289347/using-strtok-with-a-stdstring
@@ -25,36 +33,63 @@ std::vector<std::string> split_string(const std::string& str, const std::string&
     return parts;
 }
 
-void print_info(const char* msg) {
-    std::vector<std::string> parts;
-    parts = split_string(msg, "\n");
-    for (auto it = parts.begin(); it < parts.end(); it++) {
-        printf("\033[96m[INFO]\033[0m %s\n", (*it).c_str());
+// Sink of the current thread, nullptr outside a Log_scope
+static thread_local const Log_sink* thread_sink = nullptr;
+
+Log_scope::Log_scope(const Log_sink& sink) : previous(thread_sink) {
+    thread_sink = &sink;
+}
+
+Log_scope::~Log_scope() {
+    thread_sink = previous;
+}
+
+void log_to_stdout(Log_level level, const std::string& msg) {
+    switch (level) {
+        case Log_level::INFO:
+            printf("\033[96m[INFO]\033[0m %s\n", msg.c_str());
+            break;
+        case Log_level::WARNING:
+            printf("\033[93m[WARN]\033[0m %s\n", msg.c_str());
+            break;
+        case Log_level::ERROR:
+            printf("\033[91m[ERROR]\033[0m %s\n", msg.c_str());
+            break;
+        case Log_level::AVR_STDOUT:
+            printf("%s\n", msg.c_str());
+            break;
+        case Log_level::AVR_STDERR:
+            fprintf(stderr, "%s\n", msg.c_str());
+            fflush(stderr);
+            return;
     }
     fflush(stdout);
 }
 
-void print_warning(const char* msg) {
-    std::vector<std::string> parts;
-    parts = split_string(msg, "\n");
-    for (auto it = parts.begin(); it < parts.end(); it++) {
-        printf("\033[93m[WARN]\033[0m %s\n", (*it).c_str());
+void log_message(Log_level level, const std::string& msg) {
+    for (auto& line : split_string(msg, "\n")) {
+        if (!thread_sink) {
+            log_to_stdout(level, line);
+        } else if (*thread_sink) {
+            (*thread_sink)(level, line);
+        }
     }
-    fflush(stdout);
+}
+
+void print_info(const char* msg) {
+    log_message(Log_level::INFO, msg);
+}
+
+void print_warning(const char* msg) {
+    log_message(Log_level::WARNING, msg);
 }
 
 void print_error(const char* msg) {
-    std::vector<std::string> parts;
-    parts = split_string(msg, "\n");
-    for (auto it = parts.begin(); it < parts.end(); it++) {
-        printf("\033[91m[ERROR]\033[0m %s\n", (*it).c_str());
-    }
-    exit(-1);
+    log_message(Log_level::ERROR, msg);
 }
 
 void parse_err_msg(uint line, const char* msg) {
-    printf("\033[91m[ERROR]\033[0m Error parsing file at line %u: %s\n", line, msg);
-    exit(-1);
+    throw DQBF_error("Error parsing file at line " + std::to_string(line) + ": " + msg);
 }
 
 z3::expr bool2bv(z3::expr b) {
@@ -75,8 +110,92 @@ z3::expr bv_at(z3::expr bv, uint64_t idx) {
     return (bv.extract(idx, idx) == bv.ctx().bv_val(1, 1));
 };
 
+size_t dag_size(z3::expr e) {
+    std::unordered_set<unsigned> seen;
+    std::vector<z3::expr> stack = {e};
+    while (!stack.empty()) {
+        z3::expr t = stack.back();
+        stack.pop_back();
+        if (!t.is_app() || t.num_args() == 0 || !seen.insert(t.id()).second) {
+            continue;
+        }
+        for (unsigned i = 0; i < t.num_args(); i++) {
+            stack.push_back(t.arg(i));
+        }
+    }
+    return seen.size();
+}
+
 bool file_exists(const std::string& name) {
     struct stat buffer;
     return (stat(name.c_str(), &buffer) == 0);
 }
 
+
+
+static std::string compression(const std::string& path) {
+    if (path == "-") {
+        // Magic numbers, none of them starts a dqcir/dqdimacs file
+        int c = std::cin.peek();
+        if (c == 0x1f) {
+            return "gz";
+        } else if (c == 0xfd) {
+            return "xz";
+        } else if (c == 0x28) {
+            return "zst";
+        }
+        return "";
+    }
+    std::string ext = split_string(path, ".").back();
+    if (ext == "gz" || ext == "xz" || ext == "zst") {
+        return ext;
+    }
+    return "";
+}
+
+std::unique_ptr<std::istream> open_input(const std::string& path) {
+    std::string comp = compression(path);
+    if (comp == "" && path != "-") {
+        auto file = std::make_unique<std::ifstream>(path);
+        if (!*file) {
+            throw DQBF_error("Error on opening file " + path);
+        }
+        return file;
+    }
+
+    auto input = std::make_unique<boost::iostreams::filtering_istream>();
+    if (comp == "gz") {
+        input->push(boost::iostreams::gzip_decompressor());
+    } else if (comp == "xz") {
+        input->push(boost::iostreams::lzma_decompressor());
+    } else if (comp == "zst") {
+        input->push(boost::iostreams::zstd_decompressor());
+    }
+    if (path == "-") {
+        input->push(std::cin);
+    } else {
+        boost::iostreams::file_source file(path, std::ios_base::binary);
+        if (!file.is_open()) {
+            throw DQBF_error("Error on opening file " + path);
+        }
+        input->push(file);
+    }
+    return input;
+}
+
+std::string input_format(const std::string& path) {
+    std::vector<std::string> parts = split_string(path, ".");
+    if (parts.size() > 1 && compression(path) != "") {
+        parts.pop_back();
+    }
+    return parts.empty() ? "" : parts.back();
+}
+
+std::string input_format(const std::string& path, std::istream& input) {
+    if (path != "-") {
+        return input_format(path);
+    }
+    // dqdimacs starts with a comment or the header, dqcir with #QCIR, a comment or the prefix
+    int c = input.peek();
+    return (c == 'c' || c == 'p') ? "dqdimacs" : "dqcir";
+}
\ No newline at end of file